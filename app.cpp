@@ -3,9 +3,6 @@
 #include <SDL.h>
 #undef main
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
 #include "bitmap.hpp"
 #include "math.hpp"
 #include "global.hpp"
@@ -14,9 +11,7 @@
 #include "material.hpp"
 #include "mesh.hpp"
 #include "assimp_wrapper.hpp"
-
-r32 Viewport::width;
-r32 Viewport::height;
+#include "trace.hpp"
 
 int main() {
     int width = 680;
@@ -35,6 +30,7 @@ int main() {
     bitmap.height = Viewport::height;
     bitmap.depthBuffer = new r32[bitmap.width * bitmap.height];
     bitmap.InitializePerspective(20, 0.1f, 100.0f);
+    bitmap.SetThreadCount(std::thread::hardware_concurrency());
     for (int i = 0; i < bitmap.width * bitmap.height; ++i) {
         bitmap.depthBuffer[i] = 1;
     }
@@ -50,17 +46,20 @@ int main() {
     r32 timeScale = 1;
     SDL_Event event;
 
-    Bitmap lightPassFilter;
-    lightPassFilter.width = bitmap.width;
-    lightPassFilter.height = bitmap.height;
-    lightPassFilter.data = new u8[bitmap.width * bitmap.height * 4];
-
-    Bitmap blurFilter;
-    blurFilter.width = bitmap.width;
-    blurFilter.height = bitmap.height;
-    blurFilter.data = new u8[bitmap.width * bitmap.height * 4];
     int animationIndex = 0;
+
+    // b toggles bloom
+    bool bloom = false;
+
+    // k switches between linear blend and dual quaternion skinning
+    // h cycles through the heatmap debug views
+    // t starts and stops writing the pipeline stats of every frame to frame_stats.csv
+    // j writes the recorded timeline to trace.json when built with ENABLE_TRACING
+    FILE* statsFile = nullptr;
+    u32 frame = 0;
+    Trace::SetThreadName("Main");
     while (!done) {
+        TRACE_SCOPE("Frame");
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
                 case SDL_QUIT: {
@@ -110,14 +109,51 @@ int main() {
         if (keys[SDLK_e]) {
             cameraRotation -= 1;
         }
+        if (keys[SDLK_b]) {
+            bloom = !bloom;
+            keys[SDLK_b] = false;
+        }
+        if (keys[SDLK_f]) {
+            bitmap.textureFilter = (TextureFilter)((bitmap.textureFilter + 1) % (TextureFilter::Trilinear + 1));
+            keys[SDLK_f] = false;
+        }
+        if (keys[SDLK_k]) {
+            bitmap.skinningMode = (SkinningMode)((bitmap.skinningMode + 1) % (SkinningMode::DualQuaternion + 1));
+            keys[SDLK_k] = false;
+        }
+        if (keys[SDLK_r]) {
+            bitmap.SetHDRTarget(!bitmap.hdrTarget);
+            keys[SDLK_r] = false;
+        }
+        if (keys[SDLK_h]) {
+            bitmap.heatmapMode = (HeatmapMode)((bitmap.heatmapMode + 1) % (HeatmapMode::ShadingCycles + 1));
+            keys[SDLK_h] = false;
+        }
+        if (keys[SDLK_j]) {
+            Trace::WriteChromeJSON("trace.json");
+            keys[SDLK_j] = false;
+        }
+        if (keys[SDLK_t]) {
+            if (statsFile) {
+                fclose(statsFile);
+                statsFile = nullptr;
+            }
+            else {
+                statsFile = fopen("frame_stats.csv", "w");
+                if (statsFile) {
+                    FrameStats::WriteCSVHeader(statsFile);
+                }
+            }
+            keys[SDLK_t] = false;
+        }
         int pitch = 0;
         SDL_LockTexture(screenTexture, nullptr, (void**)(&bitmap.data), &pitch);
 
         bitmap.Clear(v3(0.1, 0.1, 0.1));
         time += 1;
 
-        m4 s0 = m4::Scale(v3(0.01, 0.01, 0.01));
-        m4 t0 = m4::Translation(v3(0, -1, 5));
+        constexpr m4 s0 = m4::Scale(v3(0.01, 0.01, 0.01));
+        constexpr m4 t0 = m4::Translation(v3(0, -1, 5));
         m4 r0 = m4::Rotation(180 + cameraRotation, Axis::Y);
 
         m4 ct0 = m4::Translation(cameraPosition);
@@ -132,13 +168,26 @@ int main() {
             auto it = mesh->animations.begin();
             std::advance(it, animationIndex);
             Animation* animation = it->second;
-            animation->Advance(timeScale);
+            {
+                TRACE_SCOPE("Animation::Advance");
+                animation->Advance(timeScale);
+            }
 
+            TRACE_SCOPE("CreatePoseTransforms");
             bitmap.UploadBones(animation->CreatePoseTransforms());
         }
 
         bitmap.time = time * 0.1;
         bitmap.DrawTriangles(mesh->vertices, mesh->indices, mesh->materials);
+        if (bloom) {
+            bitmap.Bloom();
+        }
+        bitmap.ResolveHDR();
+
+        if (statsFile) {
+            bitmap.stats.WriteCSV(statsFile, frame);
+        }
+        ++frame;
 
         SDL_UnlockTexture(screenTexture);
 
@@ -153,6 +202,10 @@ int main() {
         SDL_RenderPresent(renderer);
     }
 
+    if (statsFile) {
+        fclose(statsFile);
+    }
+
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
@@ -0,0 +1,789 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.hpp"
+#include "math.hpp"
+#include "global.hpp"
+
+#include "material.hpp"
+
+// Times the pipeline stages on fixed synthetic scenes so runs on different builds can be compared.
+//
+//   bench [-scene NAME] [-iterations N] [-size WIDTHxHEIGHT] [-threads N] [-bones N]
+//         [-blur SIZE] [-filter nearest|bilinear|trilinear] [-mipmaps on|off] [-layout rowmajor|tiled]
+//         [-texels rgba8|float] [-normals rgba8|rg8] [-skinning linear|dualquat]
+//         [-csv PATH] [-json PATH]
+//
+// Every stage is run once to warm up and then timed -iterations times, the median is reported.
+// vertex, clip and fragment always run on the calling thread, raster and frame use -threads.
+
+struct Scene {
+    std::string name;
+    std::vector<Vertex> vertices;
+    std::vector<u32> indices;
+    Material* material;
+    m4 modelTransform;
+    std::vector<m4> bones;
+};
+
+struct BenchResult {
+    std::string scene;
+    std::string stage;
+    u32 triangles;
+    u32 pixels;
+    r64 ms;
+};
+
+static void AddSphere(Scene& scene, i32 segments, r32 radius) {
+    u32 base = (u32)scene.vertices.size();
+    for (int i = 0; i <= segments; ++i) {
+        r32 theta = M_PI * i / segments;
+        for (int j = 0; j <= segments; ++j) {
+            r32 phi = 2 * M_PI * j / segments;
+            v3 n(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+            v3 tangent(-std::sin(phi), 0, std::cos(phi));
+            scene.vertices.push_back(Vertex(n * radius, v3((r32)j / segments, (r32)i / segments, 0), n, v3(1, 1, 1), tangent));
+        }
+    }
+    for (int i = 0; i < segments; ++i) {
+        for (int j = 0; j < segments; ++j) {
+            u32 a = base + i * (segments + 1) + j;
+            u32 b = a + segments + 1;
+            scene.indices.push_back(a);
+            scene.indices.push_back(a + 1);
+            scene.indices.push_back(b);
+            scene.indices.push_back(a + 1);
+            scene.indices.push_back(b + 1);
+            scene.indices.push_back(b);
+        }
+    }
+}
+
+// a quad in the xy plane facing the camera
+static void AddQuad(Scene& scene, v3 center, r32 halfWidth, r32 halfHeight) {
+    u32 base = (u32)scene.vertices.size();
+    v3 n(0, 0, -1);
+    v3 tangent(1, 0, 0);
+    scene.vertices.push_back(Vertex(center + v3(-halfWidth, -halfHeight, 0), v3(0, 0, 0), n, v3(1, 1, 1), tangent));
+    scene.vertices.push_back(Vertex(center + v3(halfWidth, -halfHeight, 0), v3(1, 0, 0), n, v3(1, 1, 1), tangent));
+    scene.vertices.push_back(Vertex(center + v3(halfWidth, halfHeight, 0), v3(1, 1, 0), n, v3(1, 1, 1), tangent));
+    scene.vertices.push_back(Vertex(center + v3(-halfWidth, halfHeight, 0), v3(0, 1, 0), n, v3(1, 1, 1), tangent));
+    u32 quad[6] = { 0, 2, 1, 0, 3, 2 };
+    for (u32 index : quad) {
+        scene.indices.push_back(base + index);
+    }
+}
+
+// long strips on the floor that start behind the camera, every triangle crosses the near plane
+static void AddFloorStrips(Scene& scene, i32 strips, i32 layers) {
+    v3 n(0, 1, 0);
+    v3 tangent(1, 0, 0);
+    for (int layer = 0; layer < layers; ++layer) {
+        r32 y = -0.5f - layer * 0.05f;
+        for (int i = 0; i < strips; ++i) {
+            r32 x0 = -4 + 8.0f * i / strips;
+            r32 x1 = -4 + 8.0f * (i + 1) / strips;
+            u32 base = (u32)scene.vertices.size();
+            scene.vertices.push_back(Vertex(v3(x0, y, -1), v3(0, 0, 0), n, v3(1, 1, 1), tangent));
+            scene.vertices.push_back(Vertex(v3(x1, y, -1), v3(1, 0, 0), n, v3(1, 1, 1), tangent));
+            scene.vertices.push_back(Vertex(v3(x1, y, 12), v3(1, 1, 0), n, v3(1, 1, 1), tangent));
+            scene.vertices.push_back(Vertex(v3(x0, y, 12), v3(0, 1, 0), n, v3(1, 1, 1), tangent));
+            u32 quad[6] = { 0, 2, 1, 0, 3, 2 };
+            for (u32 index : quad) {
+                scene.indices.push_back(base + index);
+            }
+        }
+    }
+}
+
+static void ClearBones(Scene& scene) {
+    for (auto& v : scene.vertices) {
+        v.boneIds = v4i(0, 0, 0, 0);
+        v.boneWeights = v4(0, 0, 0, 0);
+    }
+}
+
+// every vertex blends four neighbouring bones out of boneCount
+static void SkinToBones(Scene& scene, i32 boneCount) {
+    for (int i = 0; i < boneCount; ++i) {
+        scene.bones.push_back(m4::Rotation(i * 0.5f, Axis::Y) * m4::Rotation(i * 0.25f, Axis::X));
+    }
+    for (u32 i = 0; i < scene.vertices.size(); ++i) {
+        Vertex& v = scene.vertices[i];
+        v.boneIds = v4i(i % boneCount, (i + 1) % boneCount, (i + 2) % boneCount, (i + 3) % boneCount);
+        v.boneWeights = v4(0.4f, 0.3f, 0.2f, 0.1f);
+    }
+}
+
+static Bitmap CheckerTexture(i32 size, v4 a, v4 b, bool mipmaps) {
+    Bitmap texture;
+    texture.width = size;
+    texture.height = size;
+    texture.data = new u8[size * size * 4];
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            v4 c = ((x / 16 + y / 16) % 2) ? a : b;
+            u8* texel = texture.data + (x + y * size) * 4;
+            texel[0] = c.x * 255;
+            texel[1] = c.y * 255;
+            texel[2] = c.z * 255;
+            texel[3] = c.w * 255;
+        }
+    }
+    if (mipmaps) {
+        texture.GenerateMipmaps();
+    }
+    return texture;
+}
+
+// how the scene textures are stored, from the command line
+struct TextureOptions {
+    bool mipmaps;
+    TextureLayout layout;
+    TexelFormat format;
+    TexelFormat normalFormat;
+};
+
+static Material* CheckerMaterial(i32 size, const TextureOptions& options) {
+    Material* material = new Material();
+    material->diffuse = CheckerTexture(size, v4(0.9, 0.6, 0.3, 1), v4(0.3, 0.4, 0.8, 1), options.mipmaps);
+    material->normal = CheckerTexture(size, v4(0.5, 0.5, 1, 1), v4(0.6, 0.5, 0.9, 1), options.mipmaps);
+    material->roughness = CheckerTexture(size, v4(1, 1, 1, 1), v4(0.2, 0.2, 0.2, 1), options.mipmaps);
+    material->emissive = CheckerTexture(size, v4(0, 0, 0, 1), v4(0.1, 0.05, 0, 1), options.mipmaps);
+    material->ambientOcclusion = CheckerTexture(size, v4(1, 1, 1, 1), v4(0.8, 0.8, 0.8, 1), options.mipmaps);
+    material->ConvertTexels(options.format, options.normalFormat, options.layout);
+    return material;
+}
+
+static std::vector<Scene> CreateScenes(i32 boneCount, const TextureOptions& options) {
+    Material* untextured = new Material();
+    Material* textured = CheckerMaterial(256, options);
+
+    std::vector<Scene> scenes;
+
+    Scene fill;
+    fill.name = "fill_quad";
+    AddQuad(fill, v3(0, 0, 0), 2, 2);
+    fill.material = untextured;
+    fill.modelTransform = m4::Translation(v3(0, 0, 2));
+    scenes.push_back(fill);
+
+    Scene sphere;
+    sphere.name = "high_poly_sphere";
+    AddSphere(sphere, 256, 1);
+    sphere.material = untextured;
+    sphere.modelTransform = m4::Translation(v3(0, 0, 8));
+    scenes.push_back(sphere);
+
+    Scene skinned;
+    skinned.name = "skinned_sphere";
+    AddSphere(skinned, 128, 1);
+    SkinToBones(skinned, boneCount);
+    skinned.material = untextured;
+    skinned.modelTransform = m4::Translation(v3(0, 0, 8));
+    scenes.push_back(skinned);
+
+    // a few hundred thousand skinned vertices far enough away that rasterizing them is cheap, the frame is
+    // mostly skinning and vertex shading
+    Scene crowd;
+    crowd.name = "skinned_crowd";
+    AddSphere(crowd, 512, 1);
+    SkinToBones(crowd, boneCount);
+    crowd.material = untextured;
+    crowd.modelTransform = m4::Translation(v3(0, 0, 40));
+    scenes.push_back(crowd);
+
+    Scene nearClip;
+    nearClip.name = "near_clip";
+    AddFloorStrips(nearClip, 512, 8);
+    nearClip.material = untextured;
+    nearClip.modelTransform = m4(1.0);
+    scenes.push_back(nearClip);
+
+    Scene plain;
+    plain.name = "untextured_sphere";
+    AddSphere(plain, 64, 1);
+    plain.material = untextured;
+    plain.modelTransform = m4::Translation(v3(0, 0, 3.5));
+    scenes.push_back(plain);
+
+    Scene mapped = plain;
+    mapped.name = "textured_sphere";
+    mapped.material = textured;
+    scenes.push_back(mapped);
+
+    // large textures on a sphere a few dozen pixels wide, where mip 0 reads are spread over megabytes
+    Scene minified = plain;
+    minified.name = "minified_sphere";
+    minified.material = CheckerMaterial(1024, options);
+    minified.modelTransform = m4::Translation(v3(0, 0, 30));
+    scenes.push_back(minified);
+
+    for (auto& scene : scenes) {
+        if (scene.bones.empty()) {
+            ClearBones(scene);
+        }
+    }
+
+    return scenes;
+}
+
+// a 32KB, 8-way L1 with LRU replacement. Hardware counters are not portable, the model is enough to compare
+// how many lines two texel orders pull in for the same walk
+struct CacheModel {
+    static const u32 ways = 8;
+    static const u32 sets = 32 * 1024 / CACHE_LINE_SIZE / ways;
+    u64 tags[sets][ways];
+    u64 lastUse[sets][ways];
+    u64 clock = 0;
+    u64 misses = 0;
+
+    CacheModel() {
+        for (u32 set = 0; set < sets; ++set) {
+            for (u32 way = 0; way < ways; ++way) {
+                tags[set][way] = ~0ull;
+                lastUse[set][way] = 0;
+            }
+        }
+    }
+
+    void Touch(const void* address) {
+        u64 line = (u64)(uintptr_t)address / CACHE_LINE_SIZE;
+        u32 set = line % sets;
+        ++clock;
+        u32 oldest = 0;
+        for (u32 way = 0; way < ways; ++way) {
+            if (tags[set][way] == line) {
+                lastUse[set][way] = clock;
+                return;
+            }
+            if (lastUse[set][way] < lastUse[set][oldest]) {
+                oldest = way;
+            }
+        }
+        ++misses;
+        tags[set][oldest] = line;
+        lastUse[set][oldest] = clock;
+    }
+};
+
+// a screen of size x size pixels showing the texture rotated by degrees around its center, texelsPerPixel above 1
+// minifies. Pixels are visited in the tile order of the rasterizer
+struct TextureWalk {
+    const char* name;
+    r32 degrees;
+    r32 texelsPerPixel;
+};
+
+static void ForEachWalkUV(const TextureWalk& walk, i32 size, i32 tileSize, i32 textureSize, const std::function<void(v3)>& function) {
+    r32 radians = walk.degrees * M_PI / 180.0f;
+    r32 scale = walk.texelsPerPixel / textureSize;
+    r32 c = std::cos(radians) * scale;
+    r32 s = std::sin(radians) * scale;
+    for (int tileY = 0; tileY < size; tileY += tileSize) {
+        for (int tileX = 0; tileX < size; tileX += tileSize) {
+            for (int y = tileY; y < std::min(tileY + tileSize, size); ++y) {
+                for (int x = tileX; x < std::min(tileX + tileSize, size); ++x) {
+                    r32 dx = x - size * 0.5f;
+                    r32 dy = y - size * 0.5f;
+                    r32 u = 0.5f + c * dx - s * dy;
+                    r32 v = 0.5f + s * dx + c * dy;
+                    function(v3(u - std::floor(u), v - std::floor(v), 0));
+                }
+            }
+        }
+    }
+}
+
+// the four texels sampleLevelBilinear reads at level 0
+static void TouchBilinear(CacheModel& cache, const Bitmap& texture, v3 uv) {
+    r32 tx = uv.x * (texture.width - 1);
+    r32 ty = uv.y * (texture.height - 1);
+    i32 x0 = tx;
+    i32 y0 = ty;
+    i32 x1 = std::min(x0 + 1, texture.width - 1);
+    i32 y1 = std::min(y0 + 1, texture.height - 1);
+    const u8* texels = texture.MipData(0);
+    cache.Touch(texels + texture.TexelOffset(texture.width, x0, y0));
+    cache.Touch(texels + texture.TexelOffset(texture.width, x1, y0));
+    cache.Touch(texels + texture.TexelOffset(texture.width, x0, y1));
+    cache.Touch(texels + texture.TexelOffset(texture.width, x1, y1));
+}
+
+static r64 Median(std::vector<r64> samples) {
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// runs function once untimed and then iterations times, prepare is excluded from the measurement
+static r64 Measure(i32 iterations, const std::function<void()>& prepare, const std::function<void()>& function) {
+    prepare();
+    function();
+
+    std::vector<r64> samples;
+    for (int i = 0; i < iterations; ++i) {
+        prepare();
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        auto end = std::chrono::high_resolution_clock::now();
+        samples.push_back(std::chrono::duration<r64, std::milli>(end - start).count());
+    }
+    return Median(samples);
+}
+
+// the scalar loops math.hpp used before it went through f32x4, the baseline of the math scene
+static m4 ScalarMultiply(const m4& a, const m4& b) {
+    m4 result;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            result.m[j + i * 4] = 0;
+            for (int k = 0; k < 4; ++k) {
+                result.m[j + i * 4] += a.m[k + i * 4] * b.m[j + k * 4];
+            }
+        }
+    }
+    return result;
+}
+
+static v4 ScalarTransform(const m4& a, const v4& v) {
+    v4 result;
+    for (int i = 0; i < 4; ++i) {
+        result.m[i] = 0;
+        for (int j = 0; j < 4; ++j) {
+            result.m[i] += a.m[j + i * 4] * v.m[j];
+        }
+    }
+    return result;
+}
+
+static v3 ScalarNormalized(v3 v) {
+    r32 length = v.Length();
+    return v3(v.x / length, v.y / length, v.z / length);
+}
+
+static void PrintUsage() {
+    std::cout << "usage: bench [-scene NAME] [-iterations N] [-size WIDTHxHEIGHT] [-threads N] [-bones N]" << std::endl;
+    std::cout << "             [-blur SIZE] [-filter nearest|bilinear|trilinear] [-mipmaps on|off] [-layout rowmajor|tiled]" << std::endl;
+    std::cout << "             [-texels rgba8|float] [-normals rgba8|rg8] [-skinning linear|dualquat]" << std::endl;
+    std::cout << "             [-csv PATH] [-json PATH]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string sceneFilter;
+    i32 iterations = 10;
+    i32 width = 340;
+    i32 height = 340;
+    i32 threads = 1;
+    i32 boneCount = 64;
+    i32 blurSize = 15;
+    TextureFilter textureFilter = TextureFilter::Nearest;
+    SkinningMode skinningMode = SkinningMode::LinearBlend;
+    TextureOptions textureOptions = { true, TextureLayout::RowMajor, TexelFormat::RGBA8, TexelFormat::RGBA8 };
+    std::string csvPath;
+    std::string jsonPath;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-scene") && hasValue) {
+            sceneFilter = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-iterations") && hasValue) {
+            iterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-size") && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-threads") && hasValue) {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-bones") && hasValue) {
+            boneCount = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-blur") && hasValue) {
+            blurSize = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-skinning") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "linear")) {
+                skinningMode = SkinningMode::LinearBlend;
+            }
+            else if (!strcmp(argv[i], "dualquat")) {
+                skinningMode = SkinningMode::DualQuaternion;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-filter") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "nearest")) {
+                textureFilter = TextureFilter::Nearest;
+            }
+            else if (!strcmp(argv[i], "bilinear")) {
+                textureFilter = TextureFilter::Bilinear;
+            }
+            else if (!strcmp(argv[i], "trilinear")) {
+                textureFilter = TextureFilter::Trilinear;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-mipmaps") && hasValue) {
+            textureOptions.mipmaps = strcmp(argv[++i], "off") != 0;
+        }
+        else if (!strcmp(argv[i], "-layout") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "rowmajor")) {
+                textureOptions.layout = TextureLayout::RowMajor;
+            }
+            else if (!strcmp(argv[i], "tiled")) {
+                textureOptions.layout = TextureLayout::Tiled;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-texels") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "rgba8")) {
+                textureOptions.format = TexelFormat::RGBA8;
+            }
+            else if (!strcmp(argv[i], "float")) {
+                textureOptions.format = TexelFormat::RGBA32F;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-normals") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "rgba8")) {
+                textureOptions.normalFormat = TexelFormat::RGBA8;
+            }
+            else if (!strcmp(argv[i], "rg8")) {
+                textureOptions.normalFormat = TexelFormat::NormalRG8;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-csv") && hasValue) {
+            csvPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-json") && hasValue) {
+            jsonPath = argv[++i];
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    if (iterations <= 0 || width <= 0 || height <= 0 || boneCount <= 0 || boneCount > MAX_BONES) {
+        PrintUsage();
+        return 1;
+    }
+
+    Viewport::width = width;
+    Viewport::height = height;
+
+    Bitmap bitmap;
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.data = new u8[width * height * 4];
+    bitmap.depthBuffer = new r32[width * height];
+    bitmap.InitializePerspective(20, 0.1f, 100.0f);
+    bitmap.SetThreadCount(threads);
+    bitmap.SetViewTransform(m4::Translation(v3(0, 0, 0)));
+    bitmap.time = 0;
+    bitmap.textureFilter = textureFilter;
+    bitmap.skinningMode = skinningMode;
+
+    u32 pixels = width * height;
+    v3 clearColor(0.1, 0.1, 0.1);
+
+    std::vector<BenchResult> results;
+    std::vector<Scene> scenes = CreateScenes(boneCount, textureOptions);
+    for (auto& scene : scenes) {
+        if (!sceneFilter.empty() && sceneFilter != scene.name) {
+            continue;
+        }
+
+        u32 triangles = (u32)scene.indices.size() / 3;
+        bitmap.SetModelTransform(scene.modelTransform);
+        for (int i = 0; i < MAX_BONES; ++i) {
+            bitmap.boneTransforms[i] = m4(1.0);
+        }
+        bitmap.UploadBones(scene.bones);
+
+        // the same steps DrawTriangles takes, one at a time. Skinning runs on the workers like in a frame,
+        // the vertex stage includes it
+        bitmap.UpdateUniforms();
+        r64 skinMs = Measure(iterations, [] {}, [&] {
+            bitmap.SkinVertices(scene.vertices);
+        });
+
+        r64 vertexMs = Measure(iterations, [&] {
+            bitmap.transformedVertices.resize(scene.vertices.size());
+        }, [&] {
+            bitmap.SkinVertices(scene.vertices);
+            for (u32 i = 0; i < scene.vertices.size(); ++i) {
+                bitmap.transformedVertices[i] = bitmap.VertexFunction(scene.vertices[i], bitmap.skinnedPositions[i], bitmap.skinnedNormals[i]);
+            }
+        });
+
+        r64 clipMs = Measure(iterations, [&] {
+            bitmap.clippedFaces.clear();
+        }, [&] {
+            for (u32 i = 0; i < scene.indices.size(); i += 3) {
+                const VertexOutput& v0 = bitmap.transformedVertices[scene.indices[i + 0]];
+                const VertexOutput& v1 = bitmap.transformedVertices[scene.indices[i + 1]];
+                const VertexOutput& v2 = bitmap.transformedVertices[scene.indices[i + 2]];
+                if (!bitmap.Cull(v0, v1, v2)) {
+                    bitmap.Clip(v0, v1, v2);
+                }
+            }
+        });
+
+        std::vector<FaceOutput> ndcFaces = bitmap.clippedFaces;
+        for (auto& face : ndcFaces) {
+            face.v0.p = v4(face.v0.p.x / face.v0.p.w, face.v0.p.y / face.v0.p.w, face.v0.p.z / face.v0.p.w, face.v0.p.w);
+            face.v1.p = v4(face.v1.p.x / face.v1.p.w, face.v1.p.y / face.v1.p.w, face.v1.p.z / face.v1.p.w, face.v1.p.w);
+            face.v2.p = v4(face.v2.p.x / face.v2.p.w, face.v2.p.y / face.v2.p.w, face.v2.p.z / face.v2.p.w, face.v2.p.w);
+        }
+
+        r64 rasterMs = Measure(iterations, [&] {
+            bitmap.Clear(clearColor);
+            bitmap.clippedFaces = ndcFaces;
+        }, [&] {
+            bitmap.RasterizeTiled(scene.material);
+        });
+
+        // shades every pixel once with the first visible triangle, no coverage or depth work
+        r64 fragmentMs = 0;
+        TriangleSetup setup;
+        bool hasSetup = false;
+        for (auto& face : ndcFaces) {
+            if (bitmap.SetupTriangle(face.v0, face.v1, face.v2, setup)) {
+                hasSetup = true;
+                break;
+            }
+        }
+        if (hasSetup) {
+            volatile r32 sink = 0;
+            fragmentMs = Measure(iterations, [] {}, [&] {
+                r32 sum = 0;
+                for (u32 i = 0; i < pixels; ++i) {
+                    r32 u = (r32)(i % 97) / 97.0f;
+                    r32 v = (1 - u) * (r32)(i % 89) / 89.0f;
+                    FragmentInput input;
+                    input.Setup(*setup.v0, *setup.v1, *setup.v2, setup.invW0, setup.invW1, setup.invW2, u, v, 1 - u - v, setup.textureLod);
+                    sum += bitmap.FragmentFunction(input, scene.material).x;
+                }
+                sink = sum;
+            });
+        }
+
+        r64 frameMs = Measure(iterations, [] {}, [&] {
+            bitmap.Clear(clearColor);
+            bitmap.DrawTriangles(scene.vertices, scene.indices, scene.material);
+        });
+
+        results.push_back({ scene.name, "skin", triangles, pixels, skinMs });
+        results.push_back({ scene.name, "vertex", triangles, pixels, vertexMs });
+        results.push_back({ scene.name, "clip", triangles, pixels, clipMs });
+        results.push_back({ scene.name, "raster", triangles, pixels, rasterMs });
+        if (hasSetup) {
+            results.push_back({ scene.name, "fragment", triangles, pixels, fragmentMs });
+        }
+        results.push_back({ scene.name, "frame", triangles, pixels, frameMs });
+    }
+
+    if (sceneFilter.empty() || sceneFilter == "post") {
+        Bitmap lightPass;
+        lightPass.width = width;
+        lightPass.height = height;
+        lightPass.data = new u8[width * height * 4];
+
+        Bitmap blur;
+        blur.width = width;
+        blur.height = height;
+        blur.data = new u8[width * height * 4];
+
+        r64 lightPassMs = Measure(iterations, [] {}, [&] { bitmap.FlushLightPass(&lightPass); });
+        r64 blurMs = Measure(iterations, [] {}, [&] { lightPass.FlushBlur(&blur, blurSize); });
+        r64 addMs = Measure(iterations, [] {}, [&] { bitmap.AddBitmap(&blur); });
+        r64 bloomMs = Measure(iterations, [] {}, [&] { bitmap.Bloom(); });
+
+        results.push_back({ "post", "light_pass", 0, pixels, lightPassMs });
+        results.push_back({ "post", "blur", 0, pixels, blurMs });
+        results.push_back({ "post", "add", 0, pixels, addMs });
+        results.push_back({ "post", "bloom", 0, pixels, bloomMs });
+
+        // the same frame as a half float target, restored before every run since bloom works in place
+        std::vector<v4> frame(pixels);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                frame[x + y * width] = bitmap.GetPixelABGRToRGBA(x, y);
+            }
+        }
+        bitmap.SetHDRTarget(true);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                bitmap.SetPixel(x, y, frame[x + y * width]);
+            }
+        }
+        std::vector<u16> hdrFrame = bitmap.hdrColor;
+
+        r64 bloomHDRMs = Measure(iterations, [&] { bitmap.hdrColor = hdrFrame; }, [&] { bitmap.Bloom(); });
+        r64 resolveMs = Measure(iterations, [] {}, [&] { bitmap.ResolveHDR(); });
+        bitmap.SetHDRTarget(false);
+
+        results.push_back({ "post", "bloom_hdr", 0, pixels, bloomHDRMs });
+        results.push_back({ "post", "resolve_hdr", 0, pixels, resolveMs });
+    }
+
+    // bilinear reads of level 0 along rotated and minified walks, once per layout. The miss counts come from
+    // CacheModel since the timings alone are at the mercy of whatever the real caches hold
+    std::vector<std::string> missLines;
+    if (sceneFilter.empty() || sceneFilter == "texture_layout") {
+        const i32 textureSize = 2048;
+        const i32 walkSize = std::min(width, height);
+        const TextureWalk walks[] = {
+            { "rot0", 0, 1 },
+            { "rot45", 45, 1 },
+            { "rot90", 90, 1 },
+            { "min4x", 30, 4 },
+        };
+        const TextureLayout layouts[] = { TextureLayout::RowMajor, TextureLayout::Tiled };
+        const char* layoutNames[] = { "rows", "tiled" };
+        u32 samples = walkSize * walkSize;
+
+        for (int l = 0; l < 2; ++l) {
+            Bitmap texture = CheckerTexture(textureSize, v4(0.9, 0.6, 0.3, 1), v4(0.3, 0.4, 0.8, 1), false);
+            texture.ConvertTexels(TexelFormat::RGBA8, layouts[l]);
+            for (const TextureWalk& walk : walks) {
+                volatile r32 sink = 0;
+                r64 ms = Measure(iterations, [] {}, [&] {
+                    r32 sum = 0;
+                    ForEachWalkUV(walk, walkSize, bitmap.tileSize, textureSize, [&](v3 uv) {
+                        sum += bitmap.sampleLevelBilinear(uv, &texture, 0).x;
+                    });
+                    sink = sum;
+                });
+
+                CacheModel cache;
+                ForEachWalkUV(walk, walkSize, bitmap.tileSize, textureSize, [&](v3 uv) {
+                    TouchBilinear(cache, texture, uv);
+                });
+
+                std::string stage = std::string(layoutNames[l]) + "_" + walk.name;
+                results.push_back({ "texture_layout", stage, 0, samples, ms });
+                char line[256];
+                snprintf(line, sizeof(line), "%-20s %-12s %12llu %12.3f", "texture_layout", stage.c_str(), (unsigned long long)cache.misses, (r64)cache.misses / samples);
+                missLines.push_back(line);
+            }
+        }
+    }
+
+    // the math.hpp operations against the scalar code they replaced, over a few thousand of each
+    if (sceneFilter.empty() || sceneFilter == "math") {
+        const u32 count = 4096;
+        std::vector<m4> matrices(count);
+        std::vector<v4> vectors(count);
+        std::vector<v3> directions(count);
+        for (u32 i = 0; i < count; ++i) {
+            matrices[i] = m4::Translation(v3(i * 0.01f, -0.5f, 2)) * m4::Rotation(i * 0.7f, Axis::Y) * m4::Rotation(i * 0.3f, Axis::X);
+            vectors[i] = v4(i * 0.01f, 1, -2, 1);
+            directions[i] = v3(i * 0.01f + 0.1f, 1, -2);
+        }
+        std::vector<m4> matrixOut(count);
+        std::vector<v4> vectorOut(count);
+        std::vector<v3> directionOut(count);
+
+        struct MathStage {
+            const char* name;
+            std::function<void()> run;
+        };
+        const MathStage stages[] = {
+            { "m4_mul_scalar", [&] { for (u32 i = 0; i < count; ++i) matrixOut[i] = ScalarMultiply(matrices[i], matrices[count - 1 - i]); } },
+            { "m4_mul", [&] { for (u32 i = 0; i < count; ++i) matrixOut[i] = matrices[i] * matrices[count - 1 - i]; } },
+            { "m4_v4_scalar", [&] { for (u32 i = 0; i < count; ++i) vectorOut[i] = ScalarTransform(matrices[i], vectors[i]); } },
+            { "m4_v4", [&] { for (u32 i = 0; i < count; ++i) vectorOut[i] = matrices[i] * vectors[i]; } },
+            { "normalize_scalar", [&] { for (u32 i = 0; i < count; ++i) directionOut[i] = ScalarNormalized(directions[i]); } },
+            { "normalize", [&] { for (u32 i = 0; i < count; ++i) directionOut[i] = directions[i].Normalized(); } },
+            { "affine_inverse", [&] { for (u32 i = 0; i < count; ++i) matrixOut[i] = matrices[i].AffineInverse(); } },
+        };
+        for (const MathStage& stage : stages) {
+            r64 ms = Measure(iterations, [] {}, stage.run);
+            results.push_back({ "math", stage.name, 0, count, ms });
+        }
+    }
+
+    printf("%dx%d, %d threads, %d iterations, median times\n", width, height, bitmap.threadCount, iterations);
+    printf("%-20s %-12s %10s %12s %12s %12s %10s\n", "scene", "stage", "triangles", "ms", "ns/triangle", "ns/pixel", "fps");
+    for (auto& result : results) {
+        r64 nsPerTriangle = result.triangles ? result.ms * 1e6 / result.triangles : 0;
+        printf("%-20s %-12s %10u %12.3f %12.2f %12.2f %10.1f\n", result.scene.c_str(), result.stage.c_str(), result.triangles,
+            result.ms, nsPerTriangle, result.ms * 1e6 / result.pixels, 1000.0 / result.ms);
+    }
+    if (!missLines.empty()) {
+        printf("\nsimulated 32KB L1 misses of the texture_layout walks\n");
+        printf("%-20s %-12s %12s %12s\n", "scene", "stage", "misses", "per sample");
+        for (auto& line : missLines) {
+            printf("%s\n", line.c_str());
+        }
+    }
+
+    if (!csvPath.empty()) {
+        FILE* file = fopen(csvPath.c_str(), "w");
+        if (!file) {
+            std::cout << "Could not open " << csvPath << std::endl;
+            return 1;
+        }
+        fprintf(file, "scene,stage,width,height,threads,triangles,ms,ns_per_triangle,ns_per_pixel,fps\n");
+        for (auto& result : results) {
+            r64 nsPerTriangle = result.triangles ? result.ms * 1e6 / result.triangles : 0;
+            fprintf(file, "%s,%s,%d,%d,%d,%u,%.6f,%.4f,%.4f,%.3f\n", result.scene.c_str(), result.stage.c_str(), width, height,
+                bitmap.threadCount, result.triangles, result.ms, nsPerTriangle, result.ms * 1e6 / result.pixels, 1000.0 / result.ms);
+        }
+        fclose(file);
+    }
+
+    if (!jsonPath.empty()) {
+        FILE* file = fopen(jsonPath.c_str(), "w");
+        if (!file) {
+            std::cout << "Could not open " << jsonPath << std::endl;
+            return 1;
+        }
+        fprintf(file, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"threads\": %d,\n  \"iterations\": %d,\n  \"results\": [\n",
+            width, height, bitmap.threadCount, iterations);
+        for (u32 i = 0; i < results.size(); ++i) {
+            BenchResult& result = results[i];
+            r64 nsPerTriangle = result.triangles ? result.ms * 1e6 / result.triangles : 0;
+            fprintf(file, "    {\"scene\": \"%s\", \"stage\": \"%s\", \"triangles\": %u, \"ms\": %.6f, \"ns_per_triangle\": %.4f, \"ns_per_pixel\": %.4f, \"fps\": %.3f}%s\n",
+                result.scene.c_str(), result.stage.c_str(), result.triangles, result.ms, nsPerTriangle,
+                result.ms * 1e6 / result.pixels, 1000.0 / result.ms, i + 1 < results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+        fclose(file);
+    }
+
+    return 0;
+}
@@ -1,40 +1,122 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
 #include "bitmap.hpp"
 
 #include "material.hpp"
 #include "math.hpp"
 
-VertexOutput Bitmap::VertexFunction(Vertex v) {
-    VertexOutput output;
-
-    m4 pM = m4::Perspective(fov, aspectRatio, near, far);
-    m4& mM = modelTransform;
-    m4& vM = viewTransform;
-
-    m4 boneTransform(0);
+#include <stdio.h>
+
+r32 Viewport::width;
+r32 Viewport::height;
+
+thread_local u32 Bitmap::textureSampleCounter = 0;
+TexelFormat Bitmap::loadFormat = TexelFormat::RGBA8;
+TextureLayout Bitmap::loadLayout = TextureLayout::RowMajor;
+
+void Bitmap::SkinBatch(const Vertex* vertices, u32 begin, u32 end) {
+    for (u32 i = begin; i < end; ++i) {
+        const Vertex& v = vertices[i];
+
+        // vertices without weights are not skinned
+        if (v.boneWeights.m[0] == 0) {
+            skinnedPositions[i] = v4(v.p.x, v.p.y, v.p.z, 1);
+            skinnedNormals[i] = v4(v.n.x, v.n.y, v.n.z, 0);
+            continue;
+        }
+
+        f32x4 c0(0.0f);
+        f32x4 c1(0.0f);
+        f32x4 c2(0.0f);
+        f32x4 c3(0.0f);
+        // the blended last row is 0 0 0 weightSum
+        r32 weightSum = 0;
+        for (int k = 0; k < 4; ++k) {
+            r32 weight = v.boneWeights.m[k];
+            if (weight == 0) {
+                continue;
+            }
+            const BoneMatrix& bone = boneMatrices[v.boneIds.m[k]];
+            f32x4 w(weight);
+            c0 = c0 + bone.columns[0] * w;
+            c1 = c1 + bone.columns[1] * w;
+            c2 = c2 + bone.columns[2] * w;
+            c3 = c3 + bone.columns[3] * w;
+            weightSum += weight;
+        }
+
+        f32x4 position = c0 * f32x4(v.p.x) + c1 * f32x4(v.p.y) + c2 * f32x4(v.p.z) + c3;
+        f32x4 normal = c0 * f32x4(v.n.x) + c1 * f32x4(v.n.y) + c2 * f32x4(v.n.z);
+        position.Store(skinnedPositions[i].m);
+        normal.Store(skinnedNormals[i].m);
+        skinnedPositions[i].w = weightSum;
+    }
+}
 
-    boneTransform = boneTransform + (boneTransforms[v.boneIds.m[0]] * v.boneWeights.m[0]);
-    boneTransform = boneTransform + (boneTransforms[v.boneIds.m[1]] * v.boneWeights.m[1]);
-    boneTransform = boneTransform + (boneTransforms[v.boneIds.m[2]] * v.boneWeights.m[2]);
-    boneTransform = boneTransform + (boneTransforms[v.boneIds.m[3]] * v.boneWeights.m[3]);
-    
-    if (v.boneWeights.m[0] == 0) {
-        boneTransform = m4(1.0);
+// blends the dual quaternions of the bones, normalizes the result and applies it as a rotation followed by
+// a translation. Quaternions on the far side of the first bone get their weight negated so the blend takes
+// the short way around
+void Bitmap::SkinBatchDualQuat(const Vertex* vertices, u32 begin, u32 end) {
+    for (u32 i = begin; i < end; ++i) {
+        const Vertex& v = vertices[i];
+
+        if (v.boneWeights.m[0] == 0) {
+            skinnedPositions[i] = v4(v.p.x, v.p.y, v.p.z, 1);
+            skinnedNormals[i] = v4(v.n.x, v.n.y, v.n.z, 0);
+            continue;
+        }
+
+        const v4& pivot = boneDualQuats[v.boneIds.m[0]].real;
+        f32x4 real(0.0f);
+        f32x4 dual(0.0f);
+        for (int k = 0; k < 4; ++k) {
+            r32 weight = v.boneWeights.m[k];
+            if (weight == 0) {
+                continue;
+            }
+            const DualQuat& bone = boneDualQuats[v.boneIds.m[k]];
+            r32 hemisphere = pivot.x * bone.real.x + pivot.y * bone.real.y + pivot.z * bone.real.z + pivot.w * bone.real.w;
+            f32x4 w(std::copysign(weight, hemisphere));
+            real = real + f32x4::Load(bone.real.m) * w;
+            dual = dual + f32x4::Load(bone.dual.m) * w;
+        }
+
+        r32 q[4];
+        r32 d[4];
+        real.Store(q);
+        dual.Store(d);
+        r32 invLength = 1.0f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        v3 rv = v3(q[0], q[1], q[2]) * invLength;
+        r32 rw = q[3] * invLength;
+        v3 dv = v3(d[0], d[1], d[2]) * invLength;
+        r32 dw = d[3] * invLength;
+
+        v3 p = v.p;
+        v3 n = v.n;
+        v3 translation = (dv * rw - rv * dw + v3::Cross(rv, dv)) * 2;
+        v3 position = p + v3::Cross(rv, v3::Cross(rv, p) + p * rw) * 2 + translation;
+        v3 normal = n + v3::Cross(rv, v3::Cross(rv, n) + n * rw) * 2;
+        skinnedPositions[i] = v4(position.x, position.y, position.z, 1);
+        skinnedNormals[i] = v4(normal.x, normal.y, normal.z, 0);
     }
+}
+
+VertexOutput Bitmap::VertexFunction(const Vertex& v, const v4& skinnedPosition, const v4& skinnedNormal) {
+    VertexOutput output;
 
-    v4 transformedWorldPosition = mM * (boneTransform * v.p);
-    v4 finalPosition = pM * vM * transformedWorldPosition;
+    v4 transformedWorldPosition = uniforms.model * skinnedPosition;
 
-    output.p = finalPosition;
+    output.p = uniforms.modelViewProjection * skinnedPosition;
     output.fragmentPosition = v3(transformedWorldPosition.x, transformedWorldPosition.y, transformedWorldPosition.z);
     output.fragmentUV = v.uv;
     output.fragmentColor = v.color;
 
-    v4 normal = v4(v.n.x, v.n.y, v.n.z, 0);
-    v4 transformedNormal = (mM * (boneTransform * normal));
+    v4 transformedNormal = (uniforms.normalMatrix * skinnedNormal);
     transformedNormal = transformedNormal.Normalized();
     output.fragmentNormal = v3(transformedNormal.x, transformedNormal.y, transformedNormal.z);
 
-    v4 transformedTangent = (mM * v.tangent);
+    v4 transformedTangent = (uniforms.model * v.tangent);
     output.fragmentTangent = v3(transformedTangent.x, transformedTangent.y, transformedTangent.z).Normalized();
 
     v3 fragmentBitangent = v3::Cross(output.fragmentNormal, output.fragmentTangent).Normalized();
@@ -48,19 +130,17 @@ VertexOutput Bitmap::VertexFunction(Vertex v) {
     tangentTransform.rows[2] = transformedNormal;
     tangentTransform.rows[3] = v4(0, 0, 0, 1);
 
-    v3 lightPosition(10, 10, -1);
-    v4 lightPositionInTangentSpace = tangentTransform * (lightPosition - output.fragmentPosition);
+    v4 lightPositionInTangentSpace = tangentTransform * (uniforms.lightPosition - output.fragmentPosition);
     output.fragmentLightVector = v3(lightPositionInTangentSpace.x, lightPositionInTangentSpace.y, lightPositionInTangentSpace.z);
 
-
-    v3 cameraPosition = v3(viewTransform.rows[0].w, viewTransform.rows[1].w, viewTransform.rows[2].w);
-    v4 cameraVectorInTangentSpace = tangentTransform * (cameraPosition - output.fragmentPosition);
+    v4 cameraVectorInTangentSpace = tangentTransform * (uniforms.cameraPosition - output.fragmentPosition);
     output.fragmentCameraVector = v3(cameraVectorInTangentSpace.x, cameraVectorInTangentSpace.y, cameraVectorInTangentSpace.z);
 
     return output;
 }
 
 v4 Bitmap::sampleSubpixel(v3 uv, Bitmap* texture) {
+    ++textureSampleCounter;
     r32 tx = uv.x * (texture->width - 2);
     r32 ty = uv.y * (texture->height - 2);
     int texelX = tx;
@@ -77,45 +157,186 @@ v4 Bitmap::sampleSubpixel(v3 uv, Bitmap* texture) {
     return v4::Lerp(v4::Lerp(pc0, pc1, fu), v4::Lerp(pc3, pc2, fu), fv);
 }
 
-v4 Bitmap::sample(v3 uv, Bitmap* texture) {
+v4 Bitmap::sample(v3 uv, Bitmap* texture, r32 lod) {
     if (texture->width == 0) {
         return v4(1, 1, 1, 1);
     }
-    r32 tx = uv.x * (texture->width - 1);
-    r32 ty = uv.y * (texture->height - 1);
-    int texelX = tx;
-    int texelY = ty;
-    return texture->GetPixel(texelX, texelY);
+    ++textureSampleCounter;
+
+    // magnified textures and textures without a chain stay at level 0, max takes 0 first so a nan lod does too
+    i32 lastLevel = std::max((i32)texture->mipLevels.size() - 1, 0);
+    lod = std::min(std::max(0.0f, lod + texture->lodOffset), (r32)lastLevel);
+
+    switch (textureFilter) {
+        case TextureFilter::Bilinear:
+            return sampleLevelBilinear(uv, texture, (i32)(lod + 0.5f));
+        case TextureFilter::Trilinear: {
+            i32 level = (i32)lod;
+            r32 fraction = lod - level;
+            v4 color = sampleLevelBilinear(uv, texture, level);
+            if (fraction > 0) {
+                color = v4::Lerp(color, sampleLevelBilinear(uv, texture, level + 1), fraction);
+            }
+            return color;
+        }
+        default:
+            return sampleLevelNearest(uv, texture, (i32)(lod + 0.5f));
+    }
 }
 
-v4 Bitmap::FragmentFunction(VertexOutput& o, Material* materials) {
-    v3 position = o.fragmentPosition;
-    Material* material = &materials[(int)(o.fragmentUV.z)];
+// FragmentInput::UV only wraps one period, anything further out (or nan) lands on the edge instead of
+// reading outside of the level
+static inline r32 ClampUnit(r32 t) {
+    return std::min(std::max(0.0f, t), 1.0f);
+}
+
+// the sampler functions below are instantiated for every format, layout and address mode, so each of them
+// reads its texels without checking any of the three. Bitmap::SelectSampler picks one when the texture changes
+template <TexelFormat format>
+static inline f32x4 DecodeTexel(const u8* texel);
+
+template <>
+inline f32x4 DecodeTexel<TexelFormat::RGBA8>(const u8* texel) {
+    return f32x4::LoadUnorm8(texel);
+}
+
+template <>
+inline f32x4 DecodeTexel<TexelFormat::RGBA32F>(const u8* texel) {
+    return f32x4::Load((const r32*)texel);
+}
+
+// z comes back in the same [0, 1] encoding as the other two so the fragment shader reads both formats alike
+template <>
+inline f32x4 DecodeTexel<TexelFormat::NormalRG8>(const u8* texel) {
+    r32 x = texel[0] * (2.0f / 255.0f) - 1.0f;
+    r32 y = texel[1] * (2.0f / 255.0f) - 1.0f;
+    r32 z = std::sqrt(std::max(0.0f, 1.0f - x * x - y * y));
+    return f32x4(texel[0] * (1.0f / 255.0f), texel[1] * (1.0f / 255.0f), z * 0.5f + 0.5f, 1.0f);
+}
+
+template <AddressMode address>
+static inline r32 AddressUV(r32 t) {
+    if (address == AddressMode::Repeat) {
+        t -= std::floor(t);
+    }
+    return ClampUnit(t);
+}
+
+// the texel right of or below the one at i, the edge repeats when clamping and the opposite edge follows it
+// when repeating
+template <AddressMode address>
+static inline i32 NextTexel(i32 i, i32 size) {
+    if (address == AddressMode::Repeat) {
+        return i + 1 < size ? i + 1 : 0;
+    }
+    return std::min(i + 1, size - 1);
+}
+
+static inline v4 ToV4(f32x4 color) {
+    r32 channels[4];
+    color.Store(channels);
+    return v4(channels[0], channels[1], channels[2], channels[3]);
+}
+
+template <TexelFormat format, TextureLayout layout, AddressMode address>
+static v4 SampleNearest(v3 uv, Bitmap* texture, i32 level) {
+    constexpr u32 bytes = Bitmap::BytesPerTexel(format);
+    i32 levelWidth = level ? texture->mipLevels[level].width : texture->width;
+    i32 levelHeight = level ? texture->mipLevels[level].height : texture->height;
+    int texelX = AddressUV<address>(uv.x) * (levelWidth - 1);
+    int texelY = AddressUV<address>(uv.y) * (levelHeight - 1);
+    const u8* texel = texture->MipData(level) + Bitmap::TexelOffsetX(layout, bytes, texelX) +
+                      Bitmap::TexelOffsetY(layout, bytes, levelWidth, texelY);
+    return ToV4(DecodeTexel<format>(texel));
+}
+
+// texel centers sit on the same grid as in SampleNearest
+template <TexelFormat format, TextureLayout layout, AddressMode address>
+static v4 SampleBilinear(v3 uv, Bitmap* texture, i32 level) {
+    constexpr u32 bytes = Bitmap::BytesPerTexel(format);
+    i32 levelWidth = level ? texture->mipLevels[level].width : texture->width;
+    i32 levelHeight = level ? texture->mipLevels[level].height : texture->height;
+    r32 tx = AddressUV<address>(uv.x) * (levelWidth - 1);
+    r32 ty = AddressUV<address>(uv.y) * (levelHeight - 1);
+    i32 x0 = tx;
+    i32 y0 = ty;
+    i32 x1 = NextTexel<address>(x0, levelWidth);
+    i32 y1 = NextTexel<address>(y0, levelHeight);
+    f32x4 fu(tx - x0);
+    f32x4 fv(ty - y0);
+
+    const u8* texels = texture->MipData(level);
+    u32 column0 = Bitmap::TexelOffsetX(layout, bytes, x0);
+    u32 column1 = Bitmap::TexelOffsetX(layout, bytes, x1);
+    const u8* row0 = texels + Bitmap::TexelOffsetY(layout, bytes, levelWidth, y0);
+    const u8* row1 = texels + Bitmap::TexelOffsetY(layout, bytes, levelWidth, y1);
+    f32x4 t00 = DecodeTexel<format>(row0 + column0);
+    f32x4 t10 = DecodeTexel<format>(row0 + column1);
+    f32x4 t01 = DecodeTexel<format>(row1 + column0);
+    f32x4 t11 = DecodeTexel<format>(row1 + column1);
+
+    f32x4 top = t00 + (t10 - t00) * fu;
+    f32x4 bottom = t01 + (t11 - t01) * fu;
+    return ToV4(top + (bottom - top) * fv);
+}
+
+struct TextureSampler {
+    v4 (*nearest)(v3 uv, Bitmap* texture, i32 level);
+    v4 (*bilinear)(v3 uv, Bitmap* texture, i32 level);
+};
+
+#define SAMPLER(format, layout) \
+    { SampleNearest<format, layout, AddressMode::ClampToEdge>, SampleBilinear<format, layout, AddressMode::ClampToEdge> }, \
+    { SampleNearest<format, layout, AddressMode::Repeat>, SampleBilinear<format, layout, AddressMode::Repeat> }
+
+// indexed by Bitmap::samplerIndex
+static const TextureSampler samplers[] = {
+    SAMPLER(TexelFormat::RGBA8, TextureLayout::RowMajor),
+    SAMPLER(TexelFormat::RGBA8, TextureLayout::Tiled),
+    SAMPLER(TexelFormat::RGBA32F, TextureLayout::RowMajor),
+    SAMPLER(TexelFormat::RGBA32F, TextureLayout::Tiled),
+    SAMPLER(TexelFormat::NormalRG8, TextureLayout::RowMajor),
+    SAMPLER(TexelFormat::NormalRG8, TextureLayout::Tiled),
+};
+
+#undef SAMPLER
+
+v4 Bitmap::sampleLevelNearest(v3 uv, Bitmap* texture, i32 level) {
+    return samplers[texture->samplerIndex].nearest(uv, texture, level);
+}
+
+v4 Bitmap::sampleLevelBilinear(v3 uv, Bitmap* texture, i32 level) {
+    return samplers[texture->samplerIndex].bilinear(uv, texture, level);
+}
+
+v4 Bitmap::FragmentFunction(const FragmentInput& in, Material* materials) {
+    v3 uv = in.UV();
+    Material* material = &materials[(int)(uv.z)];
+    v3 position;
     v3 normal;
     v4 diffuseColor;
     v3 pToL;
     if (material->normal.width == 0) {
-        normal = o.fragmentNormal;
-        v3 lightPosition(10, 10, -1);
-
-        pToL = lightPosition - position;
+        position = in.Position();
+        normal = in.Normal();
+        pToL = uniforms.lightPosition - position;
         pToL = pToL.Normalized();
         r32 dot = Math::Dot(normal, pToL);
         dot = std::max(dot, 0.2f);
 
-        diffuseColor = sample(o.fragmentUV, &material->diffuse) * dot;
+        diffuseColor = sample(uv, &material->diffuse, in.lod) * dot;
     }
     else {
-        v4 normalSample = sample(o.fragmentUV, &material->normal);
+        v4 normalSample = sample(uv, &material->normal, in.lod);
         normal = v3(normalSample.x, normalSample.y, normalSample.z);
         normal = normal * 2 - 1;
 
-        pToL = o.fragmentLightVector;
+        pToL = in.LightVector();
         pToL = pToL.Normalized();
         r32 dot = Math::Dot(normal, pToL);
         dot = std::max(dot, 0.3f);
 
-        diffuseColor = sample(o.fragmentUV, &material->diffuse) * dot;
+        diffuseColor = sample(uv, &material->diffuse, in.lod) * dot;
     }
 
     // specular
@@ -123,30 +344,29 @@ v4 Bitmap::FragmentFunction(VertexOutput& o, Material* materials) {
     v3 reflected = Math::Reflect(invPToL, normal).Normalized();
     v3 toCamera;
     if (material->normal.width == 0) {
-        v3 cameraPosition = v3(viewTransform.rows[0].w, viewTransform.rows[1].w, viewTransform.rows[2].w);
-        toCamera = (cameraPosition - position).Normalized();
+        toCamera = (uniforms.cameraPosition - position).Normalized();
     }
     else {
-        toCamera = o.fragmentCameraVector.Normalized();
+        toCamera = in.CameraVector().Normalized();
     }
     r32 similarity = Math::Dot(reflected, toCamera);
     similarity = std::pow(std::max(similarity, 0.0f), 128);
 
     v4 specularColor = v4(0, 0, 0, 0);
     if (material->roughness.width != 0) {
-        specularColor = sample(o.fragmentUV, &material->roughness) * similarity;
+        specularColor = sample(uv, &material->roughness, in.lod) * similarity;
     }
     //
 
     // emission
     v4 emissive(0, 0, 0, 0);
     if (material->emissive.width != 0) {
-        emissive = sample(o.fragmentUV, &material->emissive);
+        emissive = sample(uv, &material->emissive, in.lod);
     }
     
     //
 
-    v4 ambientOcculion = sample(o.fragmentUV, &material->ambientOcclusion);
+    v4 ambientOcculion = sample(uv, &material->ambientOcclusion, in.lod);
     v4 color = (diffuseColor + specularColor + emissive) * ambientOcculion;
     //normal = normal * 0.5 + 0.5;
 
@@ -154,3 +374,232 @@ v4 Bitmap::FragmentFunction(VertexOutput& o, Material* materials) {
 
     return color;
 }
+
+
+// gathers one texel per lane, lanes outside of mask are left at zero
+v4x4 Bitmap::sampleX4(const v3x4& uv, Bitmap* texture, i32 mask, r32 lod) {
+    r32 u[4];
+    r32 v[4];
+    uv.x.Store(u);
+    uv.y.Store(v);
+
+    r32 texels[4][4] = {};
+    for (int lane = 0; lane < 4; ++lane) {
+        if (mask & (1 << lane)) {
+            v4 texel = sample(v3(u[lane], v[lane], 0), texture, lod);
+            texels[0][lane] = texel.x;
+            texels[1][lane] = texel.y;
+            texels[2][lane] = texel.z;
+            texels[3][lane] = texel.w;
+        }
+    }
+
+    return v4x4(f32x4::Load(texels[0]), f32x4::Load(texels[1]), f32x4::Load(texels[2]), f32x4::Load(texels[3]));
+}
+
+// FragmentFunction for four pixels, the interpolated uv.z is always 0 there as well so the first material is used
+v4x4 Bitmap::FragmentFunctionX4(const FragmentInputX4& in, Material* materials, i32 mask) {
+    v3x4 uv = in.UV();
+    Material* material = &materials[0];
+    v3x4 position;
+    v3x4 normal;
+    v4x4 diffuseColor;
+    v3x4 pToL;
+    if (material->normal.width == 0) {
+        position = in.Position();
+        normal = in.Normal();
+        v3x4 lightPosition(f32x4(uniforms.lightPosition.x), f32x4(uniforms.lightPosition.y), f32x4(uniforms.lightPosition.z));
+
+        pToL = (lightPosition - position).Normalized();
+        f32x4 dot = f32x4::Max(v3x4::Dot(normal, pToL), f32x4(0.2f));
+
+        diffuseColor = sampleX4(uv, &material->diffuse, mask, in.lod) * dot;
+    }
+    else {
+        v4x4 normalSample = sampleX4(uv, &material->normal, mask, in.lod);
+        normal = v3x4(normalSample.x, normalSample.y, normalSample.z) * f32x4(2.0f) - v3x4(f32x4(1.0f), f32x4(1.0f), f32x4(1.0f));
+
+        pToL = in.LightVector().Normalized();
+        f32x4 dot = f32x4::Max(v3x4::Dot(normal, pToL), f32x4(0.3f));
+
+        diffuseColor = sampleX4(uv, &material->diffuse, mask, in.lod) * dot;
+    }
+
+    // specular
+    v3x4 invPToL = -pToL;
+    v3x4 reflected = (invPToL - normal * (f32x4(2.0f) * v3x4::Dot(invPToL, normal))).Normalized();
+    v3x4 toCamera;
+    if (material->normal.width == 0) {
+        v3x4 cameraPosition(f32x4(uniforms.cameraPosition.x), f32x4(uniforms.cameraPosition.y), f32x4(uniforms.cameraPosition.z));
+        toCamera = (cameraPosition - position).Normalized();
+    }
+    else {
+        toCamera = in.CameraVector().Normalized();
+    }
+    f32x4 similarity = f32x4::Max(v3x4::Dot(reflected, toCamera), f32x4(0.0f));
+    // pow(similarity, 128) as seven squarings
+    for (int i = 0; i < 7; ++i) {
+        similarity = similarity * similarity;
+    }
+
+    v4x4 specularColor(f32x4(0.0f), f32x4(0.0f), f32x4(0.0f), f32x4(0.0f));
+    if (material->roughness.width != 0) {
+        specularColor = sampleX4(uv, &material->roughness, mask, in.lod) * similarity;
+    }
+    //
+
+    // emission
+    v4x4 emissive(f32x4(0.0f), f32x4(0.0f), f32x4(0.0f), f32x4(0.0f));
+    if (material->emissive.width != 0) {
+        emissive = sampleX4(uv, &material->emissive, mask, in.lod);
+    }
+    //
+
+    v4x4 ambientOcculion = sampleX4(uv, &material->ambientOcclusion, mask, in.lod);
+    v4x4 color = (diffuseColor + specularColor + emissive) * ambientOcculion;
+
+    return color;
+}
+
+void FrameStats::WriteCSVHeader(FILE* file) {
+    fprintf(file, "frame,submitted,frustum_rejected,facing_rejected,clipped,clip_output,"
+                  "pixels_tested,depth_passed,depth_failed,fragments_shaded,texture_samples,"
+                  "vertex_ms,clip_ms,raster_ms,fragment_ms,post_ms\n");
+}
+
+void FrameStats::WriteCSV(FILE* file, u32 frame) const {
+    fprintf(file, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+            frame, submitted, frustumRejected, facingRejected, clipped, clipOutput,
+            pixelsTested, depthPassed, depthFailed, fragmentsShaded, textureSamples,
+            vertexMs, clipMs, rasterMs, fragmentMs, postMs);
+}
+
+void FrameStats::WriteJSON(FILE* file, u32 frame) const {
+    fprintf(file, "{\"frame\": %u, \"submitted\": %u, \"frustum_rejected\": %u, \"facing_rejected\": %u, "
+                  "\"clipped\": %u, \"clip_output\": %u, \"pixels_tested\": %u, \"depth_passed\": %u, "
+                  "\"depth_failed\": %u, \"fragments_shaded\": %u, \"texture_samples\": %u, "
+                  "\"vertex_ms\": %.4f, \"clip_ms\": %.4f, \"raster_ms\": %.4f, \"fragment_ms\": %.4f, \"post_ms\": %.4f}",
+            frame, submitted, frustumRejected, facingRejected, clipped, clipOutput,
+            pixelsTested, depthPassed, depthFailed, fragmentsShaded, textureSamples,
+            vertexMs, clipMs, rasterMs, fragmentMs, postMs);
+}
+
+static u32 Crc32(const u8* data, u32 size, u32 crc = 0) {
+    static u32 table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (u32 i = 0; i < 256; ++i) {
+            u32 c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+
+    crc = ~crc;
+    for (u32 i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void PushBigEndian(std::vector<u8>& out, u32 value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void WritePNGChunk(FILE* file, const char* type, const std::vector<u8>& payload) {
+    std::vector<u8> chunk;
+    PushBigEndian(chunk, (u32)payload.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    PushBigEndian(chunk, Crc32(chunk.data() + 4, (u32)chunk.size() - 4));
+    fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+// uncompressed (stored deflate blocks) RGBA png, big but needs no encoder library
+static void WritePNG(FILE* file, const u8* rgba, i32 width, i32 height) {
+    static const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+
+    std::vector<u8> header;
+    PushBigEndian(header, width);
+    PushBigEndian(header, height);
+    header.push_back(8); // bit depth
+    header.push_back(6); // RGBA
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    WritePNGChunk(file, "IHDR", header);
+
+    // every row is prefixed by filter type 0
+    std::vector<u8> raw;
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgba + y * width * 4, rgba + (y + 1) * width * 4);
+    }
+
+    std::vector<u8> zlib = { 0x78, 0x01 };
+    u32 a = 1;
+    u32 b = 0;
+    for (u8 byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    for (size_t offset = 0; offset < raw.size(); offset += 65535) {
+        u32 size = (u32)std::min<size_t>(65535, raw.size() - offset);
+        bool last = offset + size == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back(size & 0xff);
+        zlib.push_back(size >> 8);
+        zlib.push_back(~size & 0xff);
+        zlib.push_back((~size >> 8) & 0xff);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + size);
+    }
+    PushBigEndian(zlib, (b << 16) | a);
+    WritePNGChunk(file, "IDAT", zlib);
+
+    WritePNGChunk(file, "IEND", {});
+}
+
+bool Bitmap::SaveToFile(const std::string& path, ImageFormat format) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cout << "Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    // the render target keeps its pixels as ABGR
+    std::vector<u8> rgba(width * height * 4);
+    for (int i = 0; i < width * height; ++i) {
+        rgba[i * 4 + 0] = data[i * 4 + 3];
+        rgba[i * 4 + 1] = data[i * 4 + 2];
+        rgba[i * 4 + 2] = data[i * 4 + 1];
+        rgba[i * 4 + 3] = data[i * 4 + 0];
+    }
+
+    switch (format) {
+    case ImageFormat::PPM: {
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        for (int i = 0; i < width * height; ++i) {
+            fwrite(&rgba[i * 4], 1, 3, file);
+        }
+        break;
+    }
+    case ImageFormat::PNG: {
+        WritePNG(file, rgba.data(), width, height);
+        break;
+    }
+    case ImageFormat::Raw: {
+        fwrite(rgba.data(), 1, rgba.size(), file);
+        break;
+    }
+    }
+
+    fclose(file);
+    return true;
+}
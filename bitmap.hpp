@@ -4,10 +4,18 @@
 #include "math.hpp"
 
 #include <assert.h>
+#include <float.h>
+#include <stdio.h>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <list>
+#include <algorithm>
 #include "vertex.hpp"
+#include "worker_pool.hpp"
+#include "simd.hpp"
+#include "trace.hpp"
+#include "half.hpp"
 
 #undef STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -19,6 +27,173 @@ struct Viewport {
     static r32 height;
 };
 
+enum ImageFormat {
+    PPM,
+    PNG,
+    // tightly packed RGBA8 rows
+    Raw
+};
+
+enum RasterMode {
+    // walks the bounding box testing every pixel with PointInTriangle, kept as a reference
+    BoundingBox,
+    // edge equations set up once per triangle and stepped incrementally
+    HalfSpace
+};
+
+enum ClipPlane {
+    ClipNear = 1 << 0,
+    ClipFar = 1 << 1,
+    ClipLeft = 1 << 2,
+    ClipRight = 1 << 3,
+    ClipBottom = 1 << 4,
+    ClipTop = 1 << 5,
+    ClipSides = ClipLeft | ClipRight | ClipBottom | ClipTop,
+    ClipAll = ClipNear | ClipFar | ClipSides
+};
+
+enum HeatmapMode {
+    NoHeatmap,
+    // how many times a pixel was shaded, overdraw
+    ShadedFragments,
+    FailedDepthTests,
+    // cycle counter ticks spent in the fragment function
+    ShadingCycles
+};
+
+enum CullMode {
+    NoCulling,
+    BackFaces,
+    FrontFaces
+};
+
+enum SkinningMode {
+    LinearBlend,
+    // blends rigid bones without the volume loss of linear blending around twisting joints, bone scale is ignored
+    DualQuaternion
+};
+
+enum TextureLayout {
+    // rows one after the other, as loaded
+    RowMajor,
+    // 4x4 texel tiles in row order, 64 bytes each for RGBA8 so a tile is exactly one cache line
+    Tiled
+};
+
+// how a texture stores its texels for sampling, see Bitmap::ConvertTexels
+enum TexelFormat {
+    RGBA8,
+    // four floats per texel
+    RGBA32F,
+    // x and y of a tangent space normal, z is rebuilt as sqrt(1 - x^2 - y^2) when sampled
+    NormalRG8
+};
+
+// what happens to uvs outside of [0, 1]
+enum AddressMode {
+    ClampToEdge,
+    Repeat
+};
+
+enum TextureFilter {
+    // closest texel of the closest mip level
+    Nearest,
+    // bilinear in the closest mip level
+    Bilinear,
+    // bilinear in the two closest mip levels, blended by the fraction of the lod
+    Trilinear
+};
+
+// how ResolveHDR brings linear color into [0, 1]
+enum ToneMapOperator {
+    // clamp, what the 8 bit target did before
+    NoToneMap,
+    Reinhard,
+    // Narkowicz's fit of the ACES filmic curve
+    ACESFilmic
+};
+
+// what the pipeline did since the last Clear, counters come from every stage and times are in milliseconds
+struct FrameStats {
+    u32 submitted;
+    u32 frustumRejected;
+    u32 facingRejected;
+    // triangles that crossed an enabled clip plane, and everything Clip handed on to the rasterizer
+    u32 clipped;
+    u32 clipOutput;
+
+    // pixels the coverage test ran on
+    u32 pixelsTested;
+    u32 depthPassed;
+    u32 depthFailed;
+    u32 fragmentsShaded;
+    u32 textureSamples;
+
+    r64 vertexMs;
+    r64 clipMs;
+    // setup, binning and rasterization, shading included
+    r64 rasterMs;
+    // summed over all workers and only measured when Bitmap::timeFragments is set
+    r64 fragmentMs;
+    r64 postMs;
+
+    u32 Culled() const {
+        return frustumRejected + facingRejected;
+    }
+
+    void Add(const FrameStats& other) {
+        submitted += other.submitted;
+        frustumRejected += other.frustumRejected;
+        facingRejected += other.facingRejected;
+        clipped += other.clipped;
+        clipOutput += other.clipOutput;
+        pixelsTested += other.pixelsTested;
+        depthPassed += other.depthPassed;
+        depthFailed += other.depthFailed;
+        fragmentsShaded += other.fragmentsShaded;
+        textureSamples += other.textureSamples;
+        vertexMs += other.vertexMs;
+        clipMs += other.clipMs;
+        rasterMs += other.rasterMs;
+        fragmentMs += other.fragmentMs;
+        postMs += other.postMs;
+    }
+
+    static r64 MillisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<r64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // one row per frame, WriteJSON writes a single object so a sequence of frames can be wrapped in an array
+    static void WriteCSVHeader(FILE* file);
+    void WriteCSV(FILE* file, u32 frame) const;
+    void WriteJSON(FILE* file, u32 frame) const;
+};
+
+struct EdgeFunction {
+    r32 a;
+    r32 b;
+    r32 c;
+    // same tolerance PointInTriangle uses, scaled by the edge length since the edge is not normalized
+    r32 bias;
+
+    void Setup(v3 p0, v3 p1) {
+        a = p0.y - p1.y;
+        b = p1.x - p0.x;
+        c = -(a * p0.x + b * p0.y);
+        bias = 0.0001f * std::sqrt(a * a + b * b);
+    }
+
+    r32 Evaluate(r32 x, r32 y) const {
+        return a * x + b * y + c;
+    }
+
+    void Flip() {
+        a = -a;
+        b = -b;
+        c = -c;
+    }
+};
+
 struct VertexOutput {
     v4 p;
 
@@ -98,6 +273,148 @@ struct VertexOutput {
     }
 };
 
+// barycentrics of one pixel, the varyings are only interpolated when the fragment stage asks for them
+struct FragmentInput {
+    const VertexOutput* v0;
+    const VertexOutput* v1;
+    const VertexOutput* v2;
+
+    // screen space weights
+    r32 u;
+    r32 v;
+    r32 w;
+
+    // perspective corrected weights
+    r32 pu;
+    r32 pv;
+    r32 pw;
+
+    // mip level of a texture with a single texel, see Bitmap::TextureLod
+    r32 lod;
+
+    void Setup(const VertexOutput& a, const VertexOutput& b, const VertexOutput& c, r32 invW0, r32 invW1, r32 invW2, r32 uu, r32 vv, r32 ww, r32 textureLod) {
+        v0 = &a;
+        v1 = &b;
+        v2 = &c;
+        u = uu;
+        v = vv;
+        w = ww;
+        lod = textureLod;
+
+        r32 invPespW = 1.0f / (u * invW0 + v * invW1 + w * invW2);
+        pu = u * invW0 * invPespW;
+        pv = v * invW1 * invPespW;
+        pw = w * invW2 * invPespW;
+    }
+
+    v3 Affine(v3 VertexOutput::* attribute) const {
+        return (v0->*attribute) * u + (v1->*attribute) * v + (v2->*attribute) * w;
+    }
+
+    // wrapped into [0, 1], z is left at 0
+    v3 UV() const {
+        v3 uv(v0->fragmentUV.x * pu + v1->fragmentUV.x * pv + v2->fragmentUV.x * pw,
+              v0->fragmentUV.y * pu + v1->fragmentUV.y * pv + v2->fragmentUV.y * pw,
+              0);
+
+        if (uv.x > 1) {
+            uv.x = uv.x - std::floor(uv.x);
+        }
+        if (uv.x < 0) {
+            uv.x = 1 + uv.x;
+        }
+        if (uv.y > 1) {
+            uv.y = uv.y - std::floor(uv.y);
+        }
+        if (uv.y < 0) {
+            uv.y = 1 + uv.y;
+        }
+        return uv;
+    }
+
+    v4 P() const { return v0->p * u + v1->p * v + v2->p * w; }
+    v3 Position() const { return Affine(&VertexOutput::fragmentPosition); }
+    v3 Normal() const { return Affine(&VertexOutput::fragmentNormal); }
+    v3 Color() const { return Affine(&VertexOutput::fragmentColor); }
+    v3 Tangent() const { return Affine(&VertexOutput::fragmentTangent); }
+    v3 LightVector() const { return Affine(&VertexOutput::fragmentLightVector); }
+    v3 CameraVector() const { return Affine(&VertexOutput::fragmentCameraVector); }
+    v3 FlatPosition() const { return v0->flatPosition; }
+    v3 FlatNormal() const { return v0->flatNormal; }
+};
+
+// FragmentInput for four pixels, one per lane
+struct FragmentInputX4 {
+    const VertexOutput* v0;
+    const VertexOutput* v1;
+    const VertexOutput* v2;
+
+    f32x4 u;
+    f32x4 v;
+    f32x4 w;
+
+    f32x4 pu;
+    f32x4 pv;
+    f32x4 pw;
+
+    // one lod per triangle, so the same for every lane
+    r32 lod;
+
+    void Setup(const VertexOutput& a, const VertexOutput& b, const VertexOutput& c, r32 invW0, r32 invW1, r32 invW2, f32x4 uu, f32x4 vv, f32x4 ww, r32 textureLod) {
+        v0 = &a;
+        v1 = &b;
+        v2 = &c;
+        u = uu;
+        v = vv;
+        w = ww;
+        lod = textureLod;
+
+        f32x4 w0 = u * f32x4(invW0);
+        f32x4 w1 = v * f32x4(invW1);
+        f32x4 w2 = w * f32x4(invW2);
+        f32x4 invPespW = f32x4(1.0f) / (w0 + w1 + w2);
+        pu = w0 * invPespW;
+        pv = w1 * invPespW;
+        pw = w2 * invPespW;
+    }
+
+    v3x4 Affine(v3 VertexOutput::* attribute) const {
+        const v3& a0 = v0->*attribute;
+        const v3& a1 = v1->*attribute;
+        const v3& a2 = v2->*attribute;
+        return v3x4(f32x4(a0.x) * u + f32x4(a1.x) * v + f32x4(a2.x) * w,
+                    f32x4(a0.y) * u + f32x4(a1.y) * v + f32x4(a2.y) * w,
+                    f32x4(a0.z) * u + f32x4(a1.z) * v + f32x4(a2.z) * w);
+    }
+
+    static f32x4 Wrap(f32x4 t) {
+        r32 lanes[4];
+        t.Store(lanes);
+        for (int lane = 0; lane < 4; ++lane) {
+            if (lanes[lane] > 1) {
+                lanes[lane] = lanes[lane] - std::floor(lanes[lane]);
+            }
+            if (lanes[lane] < 0) {
+                lanes[lane] = 1 + lanes[lane];
+            }
+        }
+        return f32x4::Load(lanes);
+    }
+
+    v3x4 UV() const {
+        f32x4 x = f32x4(v0->fragmentUV.x) * pu + f32x4(v1->fragmentUV.x) * pv + f32x4(v2->fragmentUV.x) * pw;
+        f32x4 y = f32x4(v0->fragmentUV.y) * pu + f32x4(v1->fragmentUV.y) * pv + f32x4(v2->fragmentUV.y) * pw;
+        return v3x4(Wrap(x), Wrap(y), f32x4(0.0f));
+    }
+
+    v3x4 Position() const { return Affine(&VertexOutput::fragmentPosition); }
+    v3x4 Normal() const { return Affine(&VertexOutput::fragmentNormal); }
+    v3x4 Color() const { return Affine(&VertexOutput::fragmentColor); }
+    v3x4 Tangent() const { return Affine(&VertexOutput::fragmentTangent); }
+    v3x4 LightVector() const { return Affine(&VertexOutput::fragmentLightVector); }
+    v3x4 CameraVector() const { return Affine(&VertexOutput::fragmentCameraVector); }
+};
+
 struct Face {
     Vertex v0;
     Vertex v1;
@@ -110,6 +427,105 @@ struct FaceOutput {
     VertexOutput v2;
 };
 
+struct TriangleSetup {
+    EdgeFunction e0;
+    EdgeFunction e1;
+    EdgeFunction e2;
+    r32 invArea;
+
+    // screen space depth of every vertex
+    r32 z0;
+    r32 z1;
+    r32 z2;
+    r32 minZ;
+
+    // 1 / w of every vertex for perspective correct interpolation
+    r32 invW0;
+    r32 invW1;
+    r32 invW2;
+
+    r32 textureLod;
+
+    // bounding box already clamped to the viewport
+    i32 minX;
+    i32 minY;
+    i32 maxX;
+    i32 maxY;
+
+    const VertexOutput* v0;
+    const VertexOutput* v1;
+    const VertexOutput* v2;
+};
+
+// what the vertex and fragment shaders read that stays the same for a whole DrawTriangles call
+struct DrawUniforms {
+    m4 model;
+    m4 modelViewProjection;
+    // rotates and scales normals, see NormalMatrix
+    m4 normalMatrix;
+    v3 cameraPosition;
+    v3 lightPosition;
+
+    // the cofactors of the upper 3x3 of transform: its inverse transpose times the determinant, which the
+    // normalize after it cancels. Keeps normals perpendicular to their surface under non-uniform scales
+    static m4 NormalMatrix(const m4& transform) {
+        v3 r0(transform.rows[0].x, transform.rows[0].y, transform.rows[0].z);
+        v3 r1(transform.rows[1].x, transform.rows[1].y, transform.rows[1].z);
+        v3 r2(transform.rows[2].x, transform.rows[2].y, transform.rows[2].z);
+        v3 c0 = v3::Cross(r1, r2);
+        v3 c1 = v3::Cross(r2, r0);
+        v3 c2 = v3::Cross(r0, r1);
+
+        m4 result;
+        result.rows[0] = v4(c0.x, c0.y, c0.z, 0);
+        result.rows[1] = v4(c1.x, c1.y, c1.z, 0);
+        result.rows[2] = v4(c2.x, c2.y, c2.z, 0);
+        return result;
+    }
+};
+
+// the top three rows of a bone transform stored by column, bone transforms are affine so the last row is
+// always 0 0 0 1. Blending one into a vertex and applying the result both take four wide multiply adds
+struct BoneMatrix {
+    f32x4 columns[4];
+};
+
+// where a mip level of a texture lives in Bitmap::mipData, level 0 is the image in data unless the texture is tiled
+struct MipLevel {
+    i32 width;
+    i32 height;
+    u32 offset;
+};
+
+// one step of the bloom blur chain
+struct BloomLevel {
+    i32 width = 0;
+    i32 height = 0;
+    // linear rgb, three floats per pixel
+    std::vector<r32> rgb;
+
+    void Resize(i32 w, i32 h) {
+        width = w;
+        height = h;
+        rgb.resize(w * h * 3);
+    }
+
+    // vertical half of a bilinear fetch: the whole row at y, in pixels of this level with texel centers at .5
+    void LerpRow(r32 y, r32* out) const {
+        y -= 0.5f;
+        i32 y0 = (i32)std::floor(y);
+        r32 fy = y - y0;
+        i32 y1 = std::min(std::max(y0 + 1, 0), height - 1);
+        y0 = std::min(std::max(y0, 0), height - 1);
+
+        const r32* top = &rgb[y0 * width * 3];
+        const r32* bottom = &rgb[y1 * width * 3];
+        for (int i = 0; i < width * 3; ++i) {
+            out[i] = top[i] + (bottom[i] - top[i]) * fy;
+        }
+    }
+};
+
 struct Bitmap {
     i32 width = 0;
     i32 height = 0;
@@ -126,6 +542,9 @@ struct Bitmap {
 
     #define MAX_BONES (250)
 
+    // vertices skinned or shaded by one job of the worker pool
+    static const u32 verticesPerJob = 1024;
+
     m4 boneTransforms[MAX_BONES];
 
     void UploadBones(const std::vector<m4> pose) {
@@ -135,22 +554,263 @@ struct Bitmap {
         }
         for (int i = 0; i < pose.size(); ++i) {
             boneTransforms[i] = pose[i];
+            boneDualQuats[i] = DualQuat::FromMatrix(pose[i]);
+        }
+    }
+
+    // poses made straight from rotation and translation keys, only dual quaternion skinning reads them
+    void UploadBones(const std::vector<DualQuat>& pose) {
+        assert(pose.size() <= MAX_BONES);
+        for (int i = 0; i < pose.size(); ++i) {
+            boneDualQuats[i] = pose[i];
+        }
+    }
+
+    SkinningMode skinningMode = SkinningMode::LinearBlend;
+    // the palette dual quaternion skinning reads, half the size of boneTransforms. Only UploadBones writes it
+    DualQuat boneDualQuats[MAX_BONES];
+
+    // boneTransforms in the layout the skinning kernel reads, rebuilt by SkinVertices so writing
+    // boneTransforms directly keeps working
+    BoneMatrix boneMatrices[MAX_BONES];
+    // object space positions and normals after skinning, one per vertex of the current draw
+    std::vector<v4> skinnedPositions;
+    std::vector<v4> skinnedNormals;
+
+    void UpdateBoneMatrices() {
+        for (int i = 0; i < MAX_BONES; ++i) {
+            const m4& bone = boneTransforms[i];
+            for (int c = 0; c < 4; ++c) {
+                boneMatrices[i].columns[c] = f32x4(bone.rows[0].m[c], bone.rows[1].m[c], bone.rows[2].m[c], 0);
+            }
+        }
+    }
+
+    // skins every vertex of a draw into skinnedPositions and skinnedNormals, in batches spread over the workers
+    void SkinVertices(const std::vector<Vertex>& vertices) {
+        TRACE_SCOPE("SkinVertices");
+        bool dualQuaternion = skinningMode == SkinningMode::DualQuaternion;
+        if (!dualQuaternion) {
+            UpdateBoneMatrices();
+        }
+        skinnedPositions.resize(vertices.size());
+        skinnedNormals.resize(vertices.size());
+
+        u32 jobs = (u32)(vertices.size() + verticesPerJob - 1) / verticesPerJob;
+        auto skinBatch = [&](u32 job, u32 worker){
+            TRACE_SCOPE("Skinning batch");
+            u32 end = std::min((u32)vertices.size(), (job + 1) * verticesPerJob);
+            if (dualQuaternion) {
+                SkinBatchDualQuat(vertices.data(), job * verticesPerJob, end);
+            }
+            else {
+                SkinBatch(vertices.data(), job * verticesPerJob, end);
+            }
+        };
+
+        if(workerPool){
+            workerPool->Dispatch(jobs, skinBatch);
+        } else {
+            for(u32 job = 0; job < jobs; ++job){
+                skinBatch(job, 0);
+            }
         }
     }
 
+    void SkinBatch(const Vertex* vertices, u32 begin, u32 end);
+    void SkinBatchDualQuat(const Vertex* vertices, u32 begin, u32 end);
+
+    // what LoadFromFile and LoadFromMemory convert textures to, set them before a model is imported
+    static TexelFormat loadFormat;
+    static TextureLayout loadLayout;
+
     static Bitmap LoadFromMemory(u8* data, u32 width, u32 height){
         assert(height == 0);
         Bitmap result = {};
         result.data = stbi_load_from_memory(data, width, &result.width, &result.height, nullptr, 4);
+        result.GenerateMipmaps();
+        result.ConvertTexels(loadFormat, loadLayout);
         return result;
     }
 
     static Bitmap LoadFromFile(const std::string& path) {
         Bitmap bitmap;
         bitmap.data = stbi_load(path.c_str(), &bitmap.width, &bitmap.height, nullptr, 4);
+        bitmap.GenerateMipmaps();
+        bitmap.ConvertTexels(loadFormat, loadLayout);
         return bitmap;
     }
 
+    // textures only: every level halves the previous one (rounding down) until 1x1, texels are 2x2 box averages.
+    // Without a chain sample reads level 0 whatever the lod
+    std::vector<MipLevel> mipLevels;
+    std::vector<u8, AlignedAllocator<u8, CACHE_LINE_SIZE>> mipData;
+    // how the texels in mipData are encoded and ordered, data is always row-major RGBA8
+    TexelFormat texelFormat = TexelFormat::RGBA8;
+    TextureLayout layout = TextureLayout::RowMajor;
+    AddressMode addressMode = AddressMode::ClampToEdge;
+    // which of the sampler functions matches format, layout and address mode, picked whenever one of them
+    // changes so sampling never checks them per texel. The defaults are sampler 0
+    u32 samplerIndex = 0;
+    // half log2 of the texel count, added to the lod of a triangle to get the level of this texture
+    r32 lodOffset = 0;
+
+    void SelectSampler() {
+        samplerIndex = (texelFormat * 2 + layout) * 2 + addressMode;
+    }
+
+    void SetAddressMode(AddressMode mode) {
+        addressMode = mode;
+        SelectSampler();
+    }
+
+    static constexpr u32 BytesPerTexel(TexelFormat format) {
+        return format == TexelFormat::RGBA32F ? 16 : (format == TexelFormat::NormalRG8 ? 2 : 4);
+    }
+
+    void GenerateMipmaps() {
+        mipLevels.clear();
+        mipData.clear();
+        texelFormat = TexelFormat::RGBA8;
+        layout = TextureLayout::RowMajor;
+        SelectSampler();
+        if (!data || width <= 0 || height <= 0) {
+            return;
+        }
+
+        // every level is laid out first so mipData does not move while the levels are written
+        mipLevels.push_back({ width, height, 0 });
+        u32 size = 0;
+        while (mipLevels.back().width > 1 || mipLevels.back().height > 1) {
+            MipLevel level = { std::max(mipLevels.back().width / 2, 1), std::max(mipLevels.back().height / 2, 1), size };
+            size += level.width * level.height * 4;
+            mipLevels.push_back(level);
+        }
+        mipData.resize(size);
+
+        for (u32 i = 1; i < mipLevels.size(); ++i) {
+            const MipLevel& source = mipLevels[i - 1];
+            const MipLevel& target = mipLevels[i];
+            const u8* in = MipData(i - 1);
+            u8* out = mipData.data() + target.offset;
+            for (int y = 0; y < target.height; ++y) {
+                i32 y0 = std::min(y * 2, source.height - 1);
+                i32 y1 = std::min(y * 2 + 1, source.height - 1);
+                for (int x = 0; x < target.width; ++x) {
+                    i32 x0 = std::min(x * 2, source.width - 1);
+                    i32 x1 = std::min(x * 2 + 1, source.width - 1);
+                    for (int c = 0; c < 4; ++c) {
+                        u32 sum = in[(x0 + y0 * source.width) * 4 + c] + in[(x1 + y0 * source.width) * 4 + c] +
+                                  in[(x0 + y1 * source.width) * 4 + c] + in[(x1 + y1 * source.width) * 4 + c];
+                        out[(x + y * target.width) * 4 + c] = (u8)((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+
+        lodOffset = 0.5f * std::log2((r32)width * height);
+    }
+
+    const u8* MipData(i32 level) const {
+        bool loaded = level == 0 && layout == TextureLayout::RowMajor && texelFormat == TexelFormat::RGBA8;
+        return loaded ? data : mipData.data() + mipLevels[level].offset;
+    }
+
+    // byte offset of a texel inside the storage MipData returns, as a column and a row part so a bilinear
+    // fetch only works out two of each. Tiles are 4x4 texels
+    static u32 TexelOffsetX(TextureLayout layout, u32 bytes, i32 x) {
+        return layout == TextureLayout::Tiled ? ((x >> 2) * 16 + (x & 3)) * bytes : x * bytes;
+    }
+
+    static u32 TexelOffsetY(TextureLayout layout, u32 bytes, i32 levelWidth, i32 y) {
+        return layout == TextureLayout::Tiled ? ((y >> 2) * ((levelWidth + 3) >> 2) * 16 + (y & 3) * 4) * bytes : y * levelWidth * bytes;
+    }
+
+    u32 TexelOffset(i32 levelWidth, i32 x, i32 y) const {
+        u32 bytes = BytesPerTexel(texelFormat);
+        return TexelOffsetX(layout, bytes, x) + TexelOffsetY(layout, bytes, levelWidth, y);
+    }
+
+    // re-encodes every level, 0 included, from the RGBA8 image and its mips. Floats skip the unpacking when
+    // sampling for four times the memory, normal maps only keep x and y. Tiles keep the footprint of a bilinear
+    // fetch or of a few neighbouring pixels in one or two cache lines whatever direction the uvs walk in,
+    // tiled levels are padded to whole tiles. data keeps the row-major image for GetPixel and anything else
+    // reading it directly
+    void ConvertTexels(TexelFormat format, TextureLayout targetLayout) {
+        if (!data || width <= 0 || height <= 0) {
+            return;
+        }
+        // an earlier conversion replaced the RGBA8 levels, start over from data
+        if (texelFormat != TexelFormat::RGBA8 || layout != TextureLayout::RowMajor) {
+            if (mipLevels.size() > 1) {
+                GenerateMipmaps();
+            }
+            else {
+                mipLevels.clear();
+                mipData.clear();
+                texelFormat = TexelFormat::RGBA8;
+                layout = TextureLayout::RowMajor;
+            }
+        }
+        if (format == TexelFormat::RGBA8 && targetLayout == TextureLayout::RowMajor) {
+            SelectSampler();
+            return;
+        }
+        if (mipLevels.empty()) {
+            mipLevels.push_back({ width, height, 0 });
+        }
+
+        u32 bytes = BytesPerTexel(format);
+        std::vector<MipLevel> convertedLevels = mipLevels;
+        u32 size = 0;
+        for (MipLevel& level : convertedLevels) {
+            level.offset = size;
+            if (targetLayout == TextureLayout::Tiled) {
+                size += ((level.width + 3) >> 2) * ((level.height + 3) >> 2) * 16 * bytes;
+            }
+            else {
+                size += level.width * level.height * bytes;
+            }
+        }
+
+        std::vector<u8, AlignedAllocator<u8, CACHE_LINE_SIZE>> converted(size);
+        for (u32 i = 0; i < convertedLevels.size(); ++i) {
+            const MipLevel& level = convertedLevels[i];
+            const u8* in = MipData(i);
+            u8* out = converted.data() + level.offset;
+            for (int y = 0; y < level.height; ++y) {
+                u8* row = out + TexelOffsetY(targetLayout, bytes, level.width, y);
+                for (int x = 0; x < level.width; ++x) {
+                    EncodeTexel(format, in + (x + y * level.width) * 4, row + TexelOffsetX(targetLayout, bytes, x));
+                }
+            }
+        }
+
+        mipLevels = convertedLevels;
+        mipData.swap(converted);
+        texelFormat = format;
+        layout = targetLayout;
+        SelectSampler();
+    }
+
+    static void EncodeTexel(TexelFormat format, const u8* rgba, u8* out) {
+        if (format == TexelFormat::RGBA32F) {
+            // the same scale the RGBA8 unpack uses, so both formats sample to the same values
+            r32 channels[4] = { rgba[0] * (1.0f / 255.0f), rgba[1] * (1.0f / 255.0f), rgba[2] * (1.0f / 255.0f), rgba[3] * (1.0f / 255.0f) };
+            memcpy(out, channels, sizeof(channels));
+        }
+        else if (format == TexelFormat::NormalRG8) {
+            out[0] = rgba[0];
+            out[1] = rgba[1];
+        }
+        else {
+            memcpy(out, rgba, 4);
+        }
+    }
+
+    // writes a render target, expects the ABGR layout SetPixel produces
+    bool SaveToFile(const std::string& path, ImageFormat format);
+
     void ComputeBarycentricWeights(v3& sp, v3& p0, v3& p1, v3& p2, r32& u, r32& v, r32& w) {
         v3 e0 = p1 - p0;
         v3 e1 = p2 - p0;
@@ -194,100 +854,101 @@ struct Bitmap {
         return d0 && d1 && d2;
     }
 
-    FaceOutput CreateClippedTriangle(r32 t0, r32 t1, r32 t2, 
-                                    VertexOutput v00, VertexOutput v10,
-                                    VertexOutput v01, VertexOutput v11,
-                                    VertexOutput v02, VertexOutput v12){
-            
-            FaceOutput result;
+    #define MAX_CLIP_VERTICES (3 + 6)
 
-            result.v0 = VertexOutput::Lerp(v00, v10, t0);
-            result.v1 = VertexOutput::Lerp(v01, v11, t1);
-            result.v2 = VertexOutput::Lerp(v02, v12, t2);
+    u32 clipPlanes = ClipPlane::ClipNear | ClipPlane::ClipSides;
 
-            return result;
+    // the side planes sit at guardBand times the viewport, triangles crossing the screen edges inside
+    // that region are not clipped and only get their bounding box clamped by the rasterizer,
+    // 1 clips exactly against the viewport
+    r32 guardBand = 8;
+
+    // plane equations in clip space, a point is inside when the dot product is not negative
+    v4 ClipPlaneEquation(u32 plane) {
+        switch (plane) {
+        case ClipPlane::ClipNear: return v4(0, 0, 1, 0);
+        case ClipPlane::ClipFar: return v4(0, 0, -1, 1);
+        case ClipPlane::ClipLeft: return v4(1, 0, 0, guardBand);
+        case ClipPlane::ClipRight: return v4(-1, 0, 0, guardBand);
+        case ClipPlane::ClipBottom: return v4(0, 1, 0, guardBand);
+        case ClipPlane::ClipTop: return v4(0, -1, 0, guardBand);
+        }
+        return v4(0, 0, 0, 1);
     }
-    
-    bool Clip(FaceOutput& face, std::list<FaceOutput>& clippedFaces, v4 point, v4 normal){
-        v4 p0 = face.v0.p;
-        v4 p1 = face.v1.p;
-        v4 p2 = face.v2.p;
-
-        bool t0 = Math::Dot(normal, p0 - point) >= (0 - 0.00001);
-        bool t1 = Math::Dot(normal, p1 - point) >= (0 - 0.00001);
-        bool t2 = Math::Dot(normal, p2 - point) >= (0 - 0.00001);
-
-        i32 pointsIn = t0 + t1 + t2;
-        
-        bool t[3] = {t0, t1, t2};
-        v4 p[3] = {p0, p1, p2};
-        VertexOutput v[3] = {face.v0, face.v1, face.v2};
-
-        if(pointsIn == 0){
-            return true;
-        } else if(pointsIn == 1) {
-            for(int i = 0; i < 3; ++i){
-                int point0 = i;
-                int point1 = (i + 1) % 3;
-                int point2 = (i + 2) % 3;
-
-                if(!t[point0] && !t[point2]){
-                    r32 t00;
-                    r32 t11;
-                    Math::Intersect(point, normal, p[point0], p[point1], &t00);
-                    Math::Intersect(point, normal, p[point1], p[point2], &t11);
-
-                    FaceOutput fo = CreateClippedTriangle(t00, 1, t11, 
-                                                        v[point0], v[point1],
-                                                        v[point0], v[point1],
-                                                        v[point1], v[point2]);
-                    clippedFaces.push_back(fo);
-                    return true;
-                } else if(!t[point0] && !t[point1]){
-                    r32 t00;
-                    r32 t11;
-                    Math::Intersect(point, normal, p[point0], p[point2], &t00);
-                    Math::Intersect(point, normal, p[point1], p[point2], &t11);
-
-                    FaceOutput fo = CreateClippedTriangle(t00, t11, 1,
-                                                        v[point0], v[point2],
-                                                        v[point1], v[point2],
-                                                        v[point1], v[point2]);
-                    clippedFaces.push_back(fo);
-                    return true;
-                }
-            }            
-        } else if(pointsIn == 2){
-            for(int i = 0; i < 3; ++i){
-                int point0 = i;
-                int point1 = (i + 1) % 3;
-                int point2 = (i + 2) % 3;
-
-                if(!t[point0]){
-                    r32 t00;
-                    r32 t11;
-                    Math::Intersect(point, normal, p[point0], p[point1], &t00);
-                    Math::Intersect(point, normal, p[point2], p[point0], &t11);
-
-                    FaceOutput fo0 = CreateClippedTriangle(t00, 1, 1,
-                                                            v[point0], v[point1],
-                                                            v[point0], v[point1],
-                                                            v[point1], v[point2]);
-
-                    FaceOutput fo1 = CreateClippedTriangle(t00, 1, t11, 
-                                                            v[point0], v[point1],
-                                                            v[point1], v[point2],
-                                                            v[point2], v[point0]);
-
-                    clippedFaces.push_back(fo0);
-                    clippedFaces.push_back(fo1);
-                    return true;
-                }
-            } 
-        } else {
-            return false;
+
+    static i32 ClipPolygon(const VertexOutput* in, i32 count, VertexOutput* out, v4 plane) {
+        i32 outCount = 0;
+        for (int i = 0; i < count; ++i) {
+            const VertexOutput& a = in[i];
+            const VertexOutput& b = in[(i + 1) % count];
+
+            r32 da = Math::Dot(plane, a.p);
+            r32 db = Math::Dot(plane, b.p);
+            bool aIn = da >= (0 - 0.00001);
+            bool bIn = db >= (0 - 0.00001);
+
+            if (aIn) {
+                out[outCount++] = a;
+            }
+            // always interpolate from the inside point so both triangles sharing the edge get the same vertex
+            if (aIn && !bIn) {
+                out[outCount++] = VertexOutput::Lerp(a, b, da / (da - db));
+            } else if (!aIn && bIn) {
+                out[outCount++] = VertexOutput::Lerp(b, a, db / (db - da));
+            }
         }
-        return false;
+        return outCount;
+    }
+
+    // Sutherland-Hodgman against the enabled planes on a polygon that lives on the stack,
+    // whatever survives is emitted as a fan into clippedFaces
+    void Clip(const VertexOutput& v0, const VertexOutput& v1, const VertexOutput& v2) {
+        u32 crossed = 0;
+        for (u32 plane = 1; plane <= clipPlanes; plane <<= 1) {
+            if (!(clipPlanes & plane)) {
+                continue;
+            }
+            v4 equation = ClipPlaneEquation(plane);
+            if (Math::Dot(equation, v0.p) < (0 - 0.00001) ||
+                Math::Dot(equation, v1.p) < (0 - 0.00001) ||
+                Math::Dot(equation, v2.p) < (0 - 0.00001)) {
+                crossed |= plane;
+            }
+        }
+
+        if (!crossed) {
+            clippedFaces.push_back({v0, v1, v2});
+            ++stats.clipOutput;
+            return;
+        }
+
+        ++stats.clipped;
+
+        VertexOutput polygons[2][MAX_CLIP_VERTICES];
+        VertexOutput* in = polygons[0];
+        VertexOutput* out = polygons[1];
+
+        in[0] = v0;
+        in[1] = v1;
+        in[2] = v2;
+        i32 count = 3;
+
+        // points created on one plane stay inside every plane the original triangle was inside of
+        for (u32 plane = 1; plane <= crossed; plane <<= 1) {
+            if (!(crossed & plane)) {
+                continue;
+            }
+            count = ClipPolygon(in, count, out, ClipPlaneEquation(plane));
+            if (count < 3) {
+                return;
+            }
+            std::swap(in, out);
+        }
+
+        for (int i = 1; i < count - 1; ++i) {
+            clippedFaces.push_back({in[0], in[i], in[i + 1]});
+        }
+        stats.clipOutput += count - 2;
     }
     
     void LineNDC(v3 p0, v3 p1, v4 c){
@@ -298,7 +959,7 @@ struct Bitmap {
     }
 
 
-    void TriangleNDC(VertexOutput v0, VertexOutput v1, VertexOutput v2, Material* material){
+    void TriangleNDCReference(VertexOutput v0, VertexOutput v1, VertexOutput v2, Material* material){
         v3 p0 = v3(v0.p.x, v0.p.y, v0.p.z);
         v3 p1 = v3(v1.p.x, v1.p.y, v1.p.z);
         v3 p2 = v3(v2.p.x, v2.p.y, v2.p.z);
@@ -310,6 +971,9 @@ struct Bitmap {
         v3 min = v3::Min(p0, v3::Min(p1, p2));
         v3 max = v3::Max(p0, v3::Max(p1, p2));
 
+        r32 screenArea = std::abs((p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x));
+        r32 textureLod = TextureLod(v0, v1, v2, screenArea);
+
         for(int y = min.y; y <= max.y; ++y){
             if(y < 0 || y >= height) {
                 continue;
@@ -319,6 +983,7 @@ struct Bitmap {
                     continue;
                 }
                 v3 sp(x, y, 0);
+                ++stats.pixelsTested;
                 if(PointInTriangle(sp, p0, p1, p2)){
                     r32 u;
                     r32 v;
@@ -328,17 +993,567 @@ struct Bitmap {
                     r32 z = u * p0.z + v * p1.z + w * p2.z;
                     r32 depthValue = z;
                     if(depthValue > depthBuffer[x + y * width]){
+                        ++stats.depthFailed;
+                        RecordDepthFail(x, y);
                         continue;
                     }
+                    ++stats.depthPassed;
                     depthBuffer[x + y * width] = depthValue;
 
-                    VertexOutput vo = VertexOutput::InterpolateBarycentric(v0, v1, v2, u, v, w);
+                    FragmentInput fragment;
+                    fragment.Setup(v0, v1, v2, 1.0f / v0.p.w, 1.0f / v1.p.w, 1.0f / v2.p.w, u, v, w, textureLod);
+
+                    SetPixel(x, y, ShadeFragment(fragment, material, x, y, stats));
+                }
+            }
+        }
+    }
+
+    bool SetupTriangle(const VertexOutput& v0, const VertexOutput& v1, const VertexOutput& v2, TriangleSetup& setup){
+        v3 p0 = v3(v0.p.x, v0.p.y, v0.p.z);
+        v3 p1 = v3(v1.p.x, v1.p.y, v1.p.z);
+        v3 p2 = v3(v2.p.x, v2.p.y, v2.p.z);
+
+        p0 = Math::NDCToSC(p0, Viewport::width, Viewport::height); 
+        p1 = Math::NDCToSC(p1, Viewport::width, Viewport::height); 
+        p2 = Math::NDCToSC(p2, Viewport::width, Viewport::height); 
+
+        setup.e0.Setup(p0, p1);
+        setup.e1.Setup(p1, p2);
+        setup.e2.Setup(p2, p0);
+
+        // facing is decided by the cull stage, triangles of the other winding get their edges flipped
+        r32 area = setup.e0.Evaluate(p2.x, p2.y);
+        if(area == 0){
+            return false;
+        }
+        if(area < 0){
+            setup.e0.Flip();
+            setup.e1.Flip();
+            setup.e2.Flip();
+            area = -area;
+        }
+        setup.invArea = 1.0f / area;
+        setup.textureLod = TextureLod(v0, v1, v2, area);
+
+        setup.z0 = p0.z;
+        setup.z1 = p1.z;
+        setup.z2 = p2.z;
+        setup.minZ = std::min(p0.z, std::min(p1.z, p2.z));
+
+        setup.invW0 = 1.0f / v0.p.w;
+        setup.invW1 = 1.0f / v1.p.w;
+        setup.invW2 = 1.0f / v2.p.w;
+
+        v3 min = v3::Min(p0, v3::Min(p1, p2));
+        v3 max = v3::Max(p0, v3::Max(p1, p2));
+
+        setup.minX = std::max((i32)min.x, 0);
+        setup.minY = std::max((i32)min.y, 0);
+        setup.maxX = std::min((i32)max.x, width - 1);
+        setup.maxY = std::min((i32)max.y, height - 1);
+
+        setup.v0 = &v0;
+        setup.v1 = &v1;
+        setup.v2 = &v2;
+
+        return setup.minX <= setup.maxX && setup.minY <= setup.maxY;
+    }
+
+    // log2 of the texels per pixel along one axis for a texture of a single texel, from the ratio of the uv
+    // and screen areas (both doubled) of the triangle. Exact for an affine mapping, the average over the
+    // triangle under perspective, which is close enough for the small triangles minification happens on
+    static r32 TextureLod(const VertexOutput& v0, const VertexOutput& v1, const VertexOutput& v2, r32 screenArea){
+        const v3& uv0 = v0.fragmentUV;
+        const v3& uv1 = v1.fragmentUV;
+        const v3& uv2 = v2.fragmentUV;
+        r32 uvArea = std::abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv1.y - uv0.y) * (uv2.x - uv0.x));
+        return 0.5f * std::log2(uvArea / screenArea);
+    }
+
+    // FragmentFunction plus the bookkeeping around it: counters, the optional timer and the heatmap
+    v4 ShadeFragment(const FragmentInput& fragment, Material* material, i32 x, i32 y, FrameStats& counters){
+        ++counters.fragmentsShaded;
+        if(!timeFragments && heatmapMode == HeatmapMode::NoHeatmap){
+            return FragmentFunction(fragment, material);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        u64 startCycles = ReadCycleCounter();
+        v4 color = FragmentFunction(fragment, material);
+        u64 cycles = ReadCycleCounter() - startCycles;
+        if(timeFragments){
+            counters.fragmentMs += FrameStats::MillisecondsSince(start);
+        }
+
+        if(heatmapMode == HeatmapMode::ShadedFragments){
+            heatmap[x + y * width] += 1;
+        } else if(heatmapMode == HeatmapMode::ShadingCycles){
+            heatmap[x + y * width] += (u32)cycles;
+        }
+        return color;
+    }
+
+    // the cycles of a span are split evenly between its visible lanes
+    v4x4 ShadeFragmentsX4(const FragmentInputX4& fragments, Material* material, i32 x, i32 y, i32 lanes, i32 visible, FrameStats& counters){
+        i32 visibleCount = LaneCount(visible);
+        counters.fragmentsShaded += visibleCount;
+        if(!timeFragments && heatmapMode == HeatmapMode::NoHeatmap){
+            return FragmentFunctionX4(fragments, material, visible);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        u64 startCycles = ReadCycleCounter();
+        v4x4 colors = FragmentFunctionX4(fragments, material, visible);
+        u64 cycles = ReadCycleCounter() - startCycles;
+        if(timeFragments){
+            counters.fragmentMs += FrameStats::MillisecondsSince(start);
+        }
+
+        if(heatmapMode == HeatmapMode::ShadedFragments || heatmapMode == HeatmapMode::ShadingCycles){
+            u32 value = heatmapMode == HeatmapMode::ShadedFragments ? 1 : (u32)(cycles / visibleCount);
+            for(int i = 0; i < lanes; ++i){
+                if(visible & (1 << i)){
+                    heatmap[x + i + y * width] += value;
+                }
+            }
+        }
+        return colors;
+    }
+
+    void RecordDepthFail(i32 x, i32 y){
+        if(heatmapMode == HeatmapMode::FailedDepthTests){
+            heatmap[x + y * width] += 1;
+        }
+    }
+
+    // rasterizes the part of the triangle that falls inside [minX, maxX] x [minY, maxY]
+    bool RasterizeTriangle(const TriangleSetup& setup, Material* material, i32 minX, i32 minY, i32 maxX, i32 maxY, FrameStats& counters){
+        minX = std::max(minX, setup.minX);
+        minY = std::max(minY, setup.minY);
+        maxX = std::min(maxX, setup.maxX);
+        maxY = std::min(maxY, setup.maxY);
+
+        if(minX > maxX || minY > maxY){
+            return false;
+        }
+
+        bool written = false;
+
+        const EdgeFunction& e0 = setup.e0;
+        const EdgeFunction& e1 = setup.e1;
+        const EdgeFunction& e2 = setup.e2;
+
+        r32 row0 = e0.Evaluate(minX, minY);
+        r32 row1 = e1.Evaluate(minX, minY);
+        r32 row2 = e2.Evaluate(minX, minY);
+
+        for(int y = minY; y <= maxY; ++y){
+            r32 w0 = row0;
+            r32 w1 = row1;
+            r32 w2 = row2;
+
+            for(int x = minX; x <= maxX; ++x){
+                if(w0 >= -e0.bias && w1 >= -e1.bias && w2 >= -e2.bias){
+                    // the edge opposite to a vertex gives that vertex its weight
+                    r32 u = w1 * setup.invArea;
+                    r32 v = w2 * setup.invArea;
+                    r32 w = w0 * setup.invArea;
+
+                    r32 z = u * setup.z0 + v * setup.z1 + w * setup.z2;
+                    r32 depthValue = z;
+                    if(depthValue <= depthBuffer[x + y * width]){
+                        depthBuffer[x + y * width] = depthValue;
+                        written = true;
+                        ++counters.depthPassed;
+
+                        FragmentInput fragment;
+                        fragment.Setup(*setup.v0, *setup.v1, *setup.v2, setup.invW0, setup.invW1, setup.invW2, u, v, w, setup.textureLod);
+
+                        SetPixel(x, y, ShadeFragment(fragment, material, x, y, counters));
+                    } else {
+                        ++counters.depthFailed;
+                        RecordDepthFail(x, y);
+                    }
+                }
+
+                w0 += e0.a;
+                w1 += e1.a;
+                w2 += e2.a;
+            }
+
+            row0 += e0.b;
+            row1 += e1.b;
+            row2 += e2.b;
+        }
+
+        counters.pixelsTested += (maxX - minX + 1) * (maxY - minY + 1);
+    
+        return written;
+    }
+
+    // same as RasterizeTriangle but coverage, depth, interpolation and shading run on spans of four pixels
+    bool RasterizeTriangleWide(const TriangleSetup& setup, Material* material, i32 minX, i32 minY, i32 maxX, i32 maxY, FrameStats& counters){
+        minX = std::max(minX, setup.minX);
+        minY = std::max(minY, setup.minY);
+        maxX = std::min(maxX, setup.maxX);
+        maxY = std::min(maxY, setup.maxY);
+
+        if(minX > maxX || minY > maxY){
+            return false;
+        }
+
+        bool written = false;
+
+        const EdgeFunction& e0 = setup.e0;
+        const EdgeFunction& e1 = setup.e1;
+        const EdgeFunction& e2 = setup.e2;
+
+        const f32x4 laneOffsets(0, 1, 2, 3);
+
+        f32x4 step0 = f32x4(e0.a * 4);
+        f32x4 step1 = f32x4(e1.a * 4);
+        f32x4 step2 = f32x4(e2.a * 4);
+
+        f32x4 bias0 = f32x4(-e0.bias);
+        f32x4 bias1 = f32x4(-e1.bias);
+        f32x4 bias2 = f32x4(-e2.bias);
+
+        f32x4 invArea = f32x4(setup.invArea);
+        f32x4 z0 = f32x4(setup.z0);
+        f32x4 z1 = f32x4(setup.z1);
+        f32x4 z2 = f32x4(setup.z2);
+
+        r32 row0 = e0.Evaluate(minX, minY);
+        r32 row1 = e1.Evaluate(minX, minY);
+        r32 row2 = e2.Evaluate(minX, minY);
+
+        for(int y = minY; y <= maxY; ++y){
+            f32x4 w0 = f32x4(row0) + f32x4(e0.a) * laneOffsets;
+            f32x4 w1 = f32x4(row1) + f32x4(e1.a) * laneOffsets;
+            f32x4 w2 = f32x4(row2) + f32x4(e2.a) * laneOffsets;
+
+            r32* depthRow = depthBuffer + y * width;
+
+            for(int x = minX; x <= maxX; x += 4){
+                i32 lanes = std::min(4, maxX - x + 1);
+
+                f32x4 covered = (w0 >= bias0) & (w1 >= bias1) & (w2 >= bias2);
+                i32 coverage = covered.Mask() & ((1 << lanes) - 1);
+
+                if(coverage){
+                    f32x4 u = w1 * invArea;
+                    f32x4 v = w2 * invArea;
+                    f32x4 w = w0 * invArea;
+                    f32x4 z = u * z0 + v * z1 + w * z2;
+
+                    // the last span of a row may hang over the right edge of the box
+                    r32 depth[4];
+                    for(int i = 0; i < lanes; ++i){
+                        depth[i] = depthRow[x + i];
+                    }
+                    f32x4 oldDepth = f32x4::Load(depth);
+                    f32x4 passed = z <= oldDepth;
+                    i32 visible = passed.Mask() & coverage;
+
+                    i32 visibleCount = LaneCount(visible);
+                    counters.depthPassed += visibleCount;
+                    counters.depthFailed += LaneCount(coverage) - visibleCount;
+                    if(heatmapMode == HeatmapMode::FailedDepthTests){
+                        for(int i = 0; i < lanes; ++i){
+                            if((coverage & ~visible) & (1 << i)){
+                                RecordDepthFail(x + i, y);
+                            }
+                        }
+                    }
+
+                    if(visible){
+                        written = true;
+                        f32x4 passedCovered = passed & covered;
+                        f32x4::Select(passedCovered, z, oldDepth).Store(depth);
+                        for(int i = 0; i < lanes; ++i){
+                            depthRow[x + i] = depth[i];
+                        }
+
+                        FragmentInputX4 fragments;
+                        fragments.Setup(*setup.v0, *setup.v1, *setup.v2, setup.invW0, setup.invW1, setup.invW2, u, v, w, setup.textureLod);
+                        v4x4 colors = ShadeFragmentsX4(fragments, material, x, y, lanes, visible, counters);
+
+                        r32 r[4];
+                        r32 g[4];
+                        r32 b[4];
+                        r32 a[4];
+                        colors.x.Store(r);
+                        colors.y.Store(g);
+                        colors.z.Store(b);
+                        colors.w.Store(a);
+
+                        for(int i = 0; i < lanes; ++i){
+                            if(visible & (1 << i)){
+                                SetPixel(x + i, y, v4(r[i], g[i], b[i], a[i]));
+                            }
+                        }
+                    }
+                }
+
+                w0 = w0 + step0;
+                w1 = w1 + step1;
+                w2 = w2 + step2;
+            }
+
+            row0 += e0.b;
+            row1 += e1.b;
+            row2 += e2.b;
+        }
+
+        counters.pixelsTested += (maxX - minX + 1) * (maxY - minY + 1);
+    
+        return written;
+    }
+
+    // picked at startup from the CPU features, the scalar path stays as fallback and reference
+    bool wideRasterizer = CpuFeatures::Get().Wide();
+
+    #define HIZ_BLOCK_SIZE (8)
+
+    // farthest depth of every 8x8 block and of every tile, a triangle whose nearest point is behind it
+    // can not pass a single depth test in there
+    std::vector<r32> blockMaxDepth;
+    std::vector<r32> tileMaxDepth;
+    // set when a block got written, its max is only brought down again when a test would need it
+    std::vector<u8> blockDirty;
+    std::vector<u8> tileDirty;
+    i32 blocksX = 0;
+    i32 blocksY = 0;
+
+    void ResetHierarchicalDepth(r32 depth){
+        blocksX = (width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+        blocksY = (height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE;
+        blockMaxDepth.assign(blocksX * blocksY, depth);
+        blockDirty.assign(blocksX * blocksY, 0);
+
+        i32 tilesX = (width + tileSize - 1) / tileSize;
+        i32 tilesY = (height + tileSize - 1) / tileSize;
+        tileMaxDepth.assign(tilesX * tilesY, depth);
+        tileDirty.assign(tilesX * tilesY, 0);
+    }
+
+    // nothing is known about the depth buffer unless Clear went through it
+    void EnsureHierarchicalDepth(){
+        i32 tilesX = (width + tileSize - 1) / tileSize;
+        i32 tilesY = (height + tileSize - 1) / tileSize;
+
+        if(blocksX != (width + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE ||
+           blocksY != (height + HIZ_BLOCK_SIZE - 1) / HIZ_BLOCK_SIZE ||
+           blockMaxDepth.size() != blocksX * blocksY ||
+           tileMaxDepth.size() != tilesX * tilesY){
+            ResetHierarchicalDepth(FLT_MAX);
+        }
+    }
+
+    void UpdateBlockDepth(i32 bx, i32 by){
+        i32 minX = bx * HIZ_BLOCK_SIZE;
+        i32 minY = by * HIZ_BLOCK_SIZE;
+        i32 maxX = std::min(minX + HIZ_BLOCK_SIZE, width);
+        i32 maxY = std::min(minY + HIZ_BLOCK_SIZE, height);
+
+        r32 maxDepth = depthBuffer[minX + minY * width];
+        for(int y = minY; y < maxY; ++y){
+            for(int x = minX; x < maxX; ++x){
+                maxDepth = std::max(maxDepth, depthBuffer[x + y * width]);
+            }
+        }
+        blockMaxDepth[bx + by * blocksX] = maxDepth;
+        blockDirty[bx + by * blocksX] = 0;
+    }
+
+    bool BlockOccludes(i32 bx, i32 by, r32 minZ){
+        i32 block = bx + by * blocksX;
+        if(minZ > blockMaxDepth[block]){
+            return true;
+        }
+        if(blockDirty[block]){
+            UpdateBlockDepth(bx, by);
+            return minZ > blockMaxDepth[block];
+        }
+        return false;
+    }
+
+    bool TileOccludes(i32 tile, r32 minZ, i32 minX, i32 minY, i32 maxX, i32 maxY){
+        if(minZ > tileMaxDepth[tile]){
+            return true;
+        }
+        // tiles are only refreshed from the block values, stale blocks keep it conservative
+        if(tileDirty[tile]){
+            tileMaxDepth[tile] = RegionMaxDepth(minX, minY, maxX, maxY);
+            tileDirty[tile] = 0;
+            return minZ > tileMaxDepth[tile];
+        }
+        return false;
+    }
 
-                    v4 color = FragmentFunction(vo, material);
-                    SetPixel(x, y, color);
+    r32 RegionMaxDepth(i32 minX, i32 minY, i32 maxX, i32 maxY){
+        r32 maxDepth = 0;
+        for(int by = minY / HIZ_BLOCK_SIZE; by <= maxY / HIZ_BLOCK_SIZE; ++by){
+            for(int bx = minX / HIZ_BLOCK_SIZE; bx <= maxX / HIZ_BLOCK_SIZE; ++bx){
+                maxDepth = std::max(maxDepth, blockMaxDepth[bx + by * blocksX]);
+            }
+        }
+        return maxDepth;
+    }
+
+    // true when no pixel of the block can be inside the edge, the edge function peaks at one of the corners
+    static bool BlockOutsideEdge(const EdgeFunction& e, r32 minX, r32 minY, r32 maxX, r32 maxY){
+        r32 x = e.a > 0 ? maxX : minX;
+        r32 y = e.b > 0 ? maxY : minY;
+        return e.Evaluate(x, y) < -e.bias;
+    }
+
+    // rasterizes block by block, skipping blocks the triangle misses or that are already nearer than it
+    bool RasterizeTriangleRegion(const TriangleSetup& setup, Material* material, i32 minX, i32 minY, i32 maxX, i32 maxY, FrameStats& counters){
+        minX = std::max(minX, setup.minX);
+        minY = std::max(minY, setup.minY);
+        maxX = std::min(maxX, setup.maxX);
+        maxY = std::min(maxY, setup.maxY);
+
+        bool written = false;
+        for(int by = minY / HIZ_BLOCK_SIZE; by <= maxY / HIZ_BLOCK_SIZE; ++by){
+            for(int bx = minX / HIZ_BLOCK_SIZE; bx <= maxX / HIZ_BLOCK_SIZE; ++bx){
+                if(BlockOccludes(bx, by, setup.minZ)){
+                    continue;
+                }
+
+                i32 blockMinX = std::max(minX, bx * HIZ_BLOCK_SIZE);
+                i32 blockMinY = std::max(minY, by * HIZ_BLOCK_SIZE);
+                i32 blockMaxX = std::min(maxX, bx * HIZ_BLOCK_SIZE + HIZ_BLOCK_SIZE - 1);
+                i32 blockMaxY = std::min(maxY, by * HIZ_BLOCK_SIZE + HIZ_BLOCK_SIZE - 1);
+
+                if(BlockOutsideEdge(setup.e0, blockMinX, blockMinY, blockMaxX, blockMaxY) ||
+                   BlockOutsideEdge(setup.e1, blockMinX, blockMinY, blockMaxX, blockMaxY) ||
+                   BlockOutsideEdge(setup.e2, blockMinX, blockMinY, blockMaxX, blockMaxY)){
+                    continue;
+                }
+
+                bool blockWritten;
+                if(wideRasterizer){
+                    blockWritten = RasterizeTriangleWide(setup, material, blockMinX, blockMinY, blockMaxX, blockMaxY, counters);
+                } else {
+                    blockWritten = RasterizeTriangle(setup, material, blockMinX, blockMinY, blockMaxX, blockMaxY, counters);
+                }
+
+                if(blockWritten){
+                    blockDirty[bx + by * blocksX] = 1;
+                    written = true;
+                }
+            }
+        }
+        return written;
+    }
+
+    void TriangleNDC(const VertexOutput& v0, const VertexOutput& v1, const VertexOutput& v2, Material* material){
+        EnsureHierarchicalDepth();
+        EnsureHeatmap();
+
+        TriangleSetup setup;
+        if(SetupTriangle(v0, v1, v2, setup)){
+            u32 samples = textureSampleCounter;
+            RasterizeTriangleRegion(setup, material, 0, 0, width - 1, height - 1, stats);
+            stats.textureSamples += textureSampleCounter - samples;
+        }
+    }
+
+    i32 threadCount = 1;
+    i32 tileSize = 32;
+    WorkerPool* workerPool = nullptr;
+
+    std::vector<TriangleSetup> triangleSetups;
+    std::vector<std::vector<u32>> tileBins;
+    std::vector<FrameStats> workerStats;
+
+    // 1 keeps the whole pipeline on the calling thread, more than that spreads the screen tiles over a pool
+    void SetThreadCount(i32 count){
+        threadCount = std::max(count, 1);
+        if(workerPool && workerPool->ThreadCount() != (u32)threadCount){
+            delete workerPool;
+            workerPool = nullptr;
+        }
+        if(!workerPool && threadCount > 1){
+            workerPool = new WorkerPool(threadCount);
+        }
+    }
+
+    void RasterizeTiled(Material* material){
+        assert(tileSize % HIZ_BLOCK_SIZE == 0);
+
+        i32 tilesX = (width + tileSize - 1) / tileSize;
+        i32 tilesY = (height + tileSize - 1) / tileSize;
+
+        EnsureHierarchicalDepth();
+
+        {
+            TRACE_SCOPE("Triangle setup and binning");
+            tileBins.resize(tilesX * tilesY);
+            for(auto& bin : tileBins){
+                bin.clear();
+            }
+
+            triangleSetups.clear();
+            for(auto& face : clippedFaces){
+                TriangleSetup setup;
+                if(SetupTriangle(face.v0, face.v1, face.v2, setup)){
+                    triangleSetups.push_back(setup);
+                }
+            }
+
+            // binning keeps submission order inside every tile, so the output does not depend on scheduling
+            for(u32 i = 0; i < triangleSetups.size(); ++i){
+                TriangleSetup& setup = triangleSetups[i];
+                for(int ty = setup.minY / tileSize; ty <= setup.maxY / tileSize; ++ty){
+                    for(int tx = setup.minX / tileSize; tx <= setup.maxX / tileSize; ++tx){
+                        tileBins[tx + ty * tilesX].push_back(i);
+                    }
                 }
             }
         }
+
+        // every worker counts into its own slot, they get summed once the tiles are done
+        workerStats.assign(threadCount, FrameStats{});
+
+        auto rasterizeTile = [&](u32 tile, u32 worker){
+            TRACE_SCOPE("Rasterize tile");
+            i32 minX = (tile % tilesX) * tileSize;
+            i32 minY = (tile / tilesX) * tileSize;
+            i32 maxX = std::min(minX + tileSize, width) - 1;
+            i32 maxY = std::min(minY + tileSize, height) - 1;
+
+            FrameStats& counters = workerStats[worker];
+            u32 samples = textureSampleCounter;
+
+            for(u32 index : tileBins[tile]){
+                TriangleSetup& setup = triangleSetups[index];
+                if(TileOccludes(tile, setup.minZ, minX, minY, maxX, maxY)){
+                    continue;
+                }
+                if(RasterizeTriangleRegion(setup, material, minX, minY, maxX, maxY, counters)){
+                    tileDirty[tile] = 1;
+                }
+            }
+
+            counters.textureSamples += textureSampleCounter - samples;
+        };
+
+        // the single threaded path walks the same tiles so the image does not change with the thread count
+        if(workerPool){
+            workerPool->Dispatch(tilesX * tilesY, rasterizeTile);
+        } else {
+            for(i32 tile = 0; tile < tilesX * tilesY; ++tile){
+                rasterizeTile(tile, 0);
+            }
+        }
+
+        for(auto& counters : workerStats){
+            stats.Add(counters);
+        }
     }
 
     void InitializePerspective(r32 pfov, r32 pnear, r32 pfar){
@@ -355,6 +1570,20 @@ struct Bitmap {
     void SetViewTransform(m4 transform){
         viewTransform = transform;
     }
+
+    v3 lightPosition = v3(10, 10, -1);
+    // filled by DrawTriangles before any vertex is shaded
+    DrawUniforms uniforms;
+
+    void UpdateUniforms(){
+        m4 projection = m4::Perspective(fov, aspectRatio, near, far);
+        uniforms.model = modelTransform;
+        uniforms.modelViewProjection = projection * viewTransform * modelTransform;
+        uniforms.normalMatrix = DrawUniforms::NormalMatrix(modelTransform);
+        // the translation column of the view transform, the camera sits at minus it
+        uniforms.cameraPosition = v3(viewTransform.rows[0].w, viewTransform.rows[1].w, viewTransform.rows[2].w);
+        uniforms.lightPosition = lightPosition;
+    }
     
     v3 cameraForward;
     v3 cameraRight;
@@ -374,57 +1603,186 @@ struct Bitmap {
         viewTransform = lookAt;
     }
 
-    std::vector<Face> faceToProcess;
-    std::list<FaceOutput> facesToBeClipped;
+    RasterMode rasterMode = RasterMode::HalfSpace;
+
+    // the reference rasterizer only ever draws front faces, whatever the cull mode
+    CullMode cullMode = CullMode::BackFaces;
+    FrameStats stats;
+    // timing every fragment call costs more than the shading of small triangles, so it is opt-in
+    bool timeFragments = false;
+    // bumped by sample on whichever thread is shading
+    static thread_local u32 textureSampleCounter;
+
+    // when set DrawTriangles replaces the shaded colors with a heatmap of what happened at every pixel,
+    // values add up over all draws since the last Clear. Every pixel belongs to one tile, so workers
+    // never write the same entry
+    HeatmapMode heatmapMode = HeatmapMode::NoHeatmap;
+    std::vector<u32> heatmap;
+    // the value drawn as the hottest color, 0 scales to the largest count of the frame, or for cycles
+    // to the 99th percentile since a single interrupt inside a measurement would wash out everything else
+    u32 heatmapScale = 0;
+
+    void EnsureHeatmap(){
+        if(heatmapMode != HeatmapMode::NoHeatmap && heatmap.size() != width * height){
+            heatmap.assign(width * height, 0);
+        }
+    }
+
+    void ResolveHeatmap(){
+        u32 scale = heatmapScale;
+        if(scale == 0 && heatmapMode == HeatmapMode::ShadingCycles){
+            std::vector<u32> values;
+            for(u32 value : heatmap){
+                if(value){
+                    values.push_back(value);
+                }
+            }
+            if(!values.empty()){
+                auto percentile = values.begin() + values.size() * 99 / 100;
+                std::nth_element(values.begin(), percentile, values.end());
+                scale = *percentile;
+            }
+        } else if(scale == 0){
+            for(u32 value : heatmap){
+                scale = std::max(scale, value);
+            }
+        }
+        if(scale == 0){
+            scale = 1;
+        }
+
+        for(int y = 0; y < height; ++y){
+            for(int x = 0; x < width; ++x){
+                r32 t = std::min((r32)heatmap[x + y * width] / scale, 1.0f);
+                SetPixelLDR(x, y, HeatmapColor(t));
+            }
+        }
+    }
+
+    // black through blue, cyan, green and yellow to red
+    static v4 HeatmapColor(r32 t){
+        const v3 stops[6] = { v3(0, 0, 0), v3(0, 0, 1), v3(0, 1, 1), v3(0, 1, 0), v3(1, 1, 0), v3(1, 0, 0) };
+        r32 position = t * 5;
+        i32 index = std::min((i32)position, 4);
+        r32 f = position - index;
+        v3 c = stops[index] * (1 - f) + stops[index + 1] * f;
+        return v4(c.x, c.y, c.z, 1);
+    }
+
+    // true when the triangle can be thrown away before clipping, works on clip space positions
+    bool Cull(const VertexOutput& v0, const VertexOutput& v1, const VertexOutput& v2){
+        const v4& p0 = v0.p;
+        const v4& p1 = v1.p;
+        const v4& p2 = v2.p;
+
+        // trivially outside when all three points are on the outer side of the same plane
+        if((p0.x > p0.w && p1.x > p1.w && p2.x > p2.w) ||
+           (p0.x < -p0.w && p1.x < -p1.w && p2.x < -p2.w) ||
+           (p0.y > p0.w && p1.y > p1.w && p2.y > p2.w) ||
+           (p0.y < -p0.w && p1.y < -p1.w && p2.y < -p2.w) ||
+           (p0.z < 0 && p1.z < 0 && p2.z < 0) ||
+           (p0.z > p0.w && p1.z > p1.w && p2.z > p2.w)){
+            ++stats.frustumRejected;
+            return true;
+        }
+
+        if(cullMode == CullMode::NoCulling){
+            return false;
+        }
+
+        // the sign of the homogeneous determinant gives the screen winding without dividing by w,
+        // front faces are the ones with a negative determinant (y gets flipped going to screen space)
+        r32 det = p0.x * (p1.y * p2.w - p2.y * p1.w) -
+                  p0.y * (p1.x * p2.w - p2.x * p1.w) +
+                  p0.w * (p1.x * p2.y - p2.x * p1.y);
+
+        bool backFacing = det >= 0;
+        if(backFacing == (cullMode == CullMode::BackFaces)){
+            ++stats.facingRejected;
+            return true;
+        }
+
+        return false;
+    }
+
+    std::vector<VertexOutput> transformedVertices;
     std::vector<FaceOutput> clippedFaces;
 
     void DrawTriangles(const std::vector<Vertex>& vertices, const std::vector<u32>& indices, Material* material) {
+        TRACE_SCOPE("DrawTriangles");
         assert(indices.size() % 3 == 0);
 
-        faceToProcess.clear();
-        facesToBeClipped.clear();
+        transformedVertices.resize(vertices.size());
         clippedFaces.clear();
+        EnsureHeatmap();
+        UpdateUniforms();
+
+        // skinning counts as vertex time
+        auto vertexStart = std::chrono::high_resolution_clock::now();
+        SkinVertices(vertices);
+
+        // every vertex is shaded once, triangles pick their corners from the results by index
+        u32 vertexJobs = (u32)(vertices.size() + verticesPerJob - 1) / verticesPerJob;
+        auto shadeVertices = [&](u32 job, u32 worker){
+            TRACE_SCOPE("Vertex batch");
+            u32 end = std::min((u32)vertices.size(), (job + 1) * verticesPerJob);
+            for(u32 i = job * verticesPerJob; i < end; ++i){
+                transformedVertices[i] = VertexFunction(vertices[i], skinnedPositions[i], skinnedNormals[i]);
+            }
+        };
 
-        for(int i = 0; i < indices.size(); i += 3){
-            Face f = {};
-            f.v0 = vertices[indices[i + 0]];
-            f.v1 = vertices[indices[i + 1]];
-            f.v2 = vertices[indices[i + 2]];
-            faceToProcess.push_back(f);
+        if(workerPool){
+            workerPool->Dispatch(vertexJobs, shadeVertices);
+        } else {
+            for(u32 job = 0; job < vertexJobs; ++job){
+                shadeVertices(job, 0);
+            }
         }
 
-        for(auto& face : faceToProcess){
-            VertexOutput vo0 = VertexFunction(face.v0);
-            VertexOutput vo1 = VertexFunction(face.v1);
-            VertexOutput vo2 = VertexFunction(face.v2);
+        stats.vertexMs += FrameStats::MillisecondsSince(vertexStart);
+        auto clipStart = std::chrono::high_resolution_clock::now();
 
-            FaceOutput fo  = {vo0, vo1, vo2};
-
-            facesToBeClipped.push_back(fo);
-        }
+        {
+            TRACE_SCOPE("Cull and clip");
+            for(int i = 0; i < indices.size(); i += 3){
+                const VertexOutput& vo0 = transformedVertices[indices[i + 0]];
+                const VertexOutput& vo1 = transformedVertices[indices[i + 1]];
+                const VertexOutput& vo2 = transformedVertices[indices[i + 2]];
 
+                ++stats.submitted;
+                if(Cull(vo0, vo1, vo2)){
+                    continue;
+                }
 
-        r32 xc = 0;
-        r32 clipSize = 1;
-        while(!facesToBeClipped.empty()){
-            FaceOutput& face = facesToBeClipped.front();
+                Clip(vo0, vo1, vo2);
+            }
 
-            bool n = Clip(face, facesToBeClipped, v4(0, 0, 0, near), v4(0, 0, 1, 0));
-            if(!n){
-                clippedFaces.push_back(face);
+            for(auto& face : clippedFaces){
+                // clip coordinates to NDC
+                face.v0.p = v4(face.v0.p.x / face.v0.p.w, face.v0.p.y / face.v0.p.w, face.v0.p.z / face.v0.p.w, face.v0.p.w);
+                face.v1.p = v4(face.v1.p.x / face.v1.p.w, face.v1.p.y / face.v1.p.w, face.v1.p.z / face.v1.p.w, face.v1.p.w);
+                face.v2.p = v4(face.v2.p.x / face.v2.p.w, face.v2.p.y / face.v2.p.w, face.v2.p.z / face.v2.p.w, face.v2.p.w);
             }
+        }
+
+        stats.clipMs += FrameStats::MillisecondsSince(clipStart);
+        auto rasterStart = std::chrono::high_resolution_clock::now();
 
-            facesToBeClipped.pop_front();
+        if(rasterMode == RasterMode::HalfSpace){
+            RasterizeTiled(material);
+        } else {
+            u32 samples = textureSampleCounter;
+            for(auto& face : clippedFaces){
+                TriangleNDCReference(face.v0, face.v1, face.v2, material);
+                //TriangleWireframeNDC(face.v0, face.v1, face.v2, v4(1, 1, 1, 1));
+            }
+            stats.textureSamples += textureSampleCounter - samples;
         }
 
-        for(auto& face : clippedFaces){
-            // clip coordinates to NDC
-            face.v0.p = v4(face.v0.p.x / face.v0.p.w, face.v0.p.y / face.v0.p.w, face.v0.p.z / face.v0.p.w, face.v0.p.w);
-            face.v1.p = v4(face.v1.p.x / face.v1.p.w, face.v1.p.y / face.v1.p.w, face.v1.p.z / face.v1.p.w, face.v1.p.w);
-            face.v2.p = v4(face.v2.p.x / face.v2.p.w, face.v2.p.y / face.v2.p.w, face.v2.p.z / face.v2.p.w, face.v2.p.w);
+        stats.rasterMs += FrameStats::MillisecondsSince(rasterStart);
 
-            TriangleNDC(face.v0, face.v1, face.v2, material);
-            //TriangleWireframeNDC(face.v0, face.v1, face.v2, v4(1, 1, 1, 1));
+        if(heatmapMode != HeatmapMode::NoHeatmap){
+            ResolveHeatmap();
         }
     }
 
@@ -444,13 +1802,83 @@ struct Bitmap {
 
     r32 time;
 
+    // how sample filters the textures it reads, the level comes from the lod the rasterizer passes along
+    TextureFilter textureFilter = TextureFilter::Nearest;
+
     v4 sampleSubpixel(v3 uv, Bitmap* texture);
-    v4 sample(v3 uv, Bitmap * texture);
+    v4 sample(v3 uv, Bitmap * texture, r32 lod);
+    v4 sampleLevelNearest(v3 uv, Bitmap* texture, i32 level);
+    v4 sampleLevelBilinear(v3 uv, Bitmap* texture, i32 level);
+
+    // position and normal come from SkinVertices
+    VertexOutput VertexFunction(const Vertex& v, const v4& skinnedPosition, const v4& skinnedNormal);
+    v4 FragmentFunction(const FragmentInput& in, Material* material);
+
+    v4x4 sampleX4(const v3x4& uv, Bitmap* texture, i32 mask, r32 lod);
+    v4x4 FragmentFunctionX4(const FragmentInputX4& in, Material* material, i32 mask);
+
+    // when set SetPixel, the post filters and Bloom work on linear half float color in hdrColor and nothing
+    // gets clamped until ResolveHDR tone maps it into data. Switch with SetHDRTarget
+    bool hdrTarget = false;
+    // RGBA halves, four per pixel
+    std::vector<u16> hdrColor;
+    r32 exposure = 1.0f;
+    ToneMapOperator toneMapOperator = ToneMapOperator::ACESFilmic;
+
+    void SetHDRTarget(bool enabled) {
+        hdrTarget = enabled;
+        if (enabled) {
+            hdrColor.resize(width * height * 4);
+        }
+        else {
+            hdrColor.clear();
+            hdrColor.shrink_to_fit();
+        }
+    }
 
-    VertexOutput VertexFunction(Vertex v);
-    v4 FragmentFunction(VertexOutput & o, Material * material);
+    static r32 ToneMap(r32 value, ToneMapOperator op) {
+        switch (op) {
+            case ToneMapOperator::Reinhard:
+                return value / (1 + value);
+            case ToneMapOperator::ACESFilmic:
+                return (value * (2.51f * value + 0.03f)) / (value * (2.43f * value + 0.59f) + 0.14f);
+            default:
+                return value;
+        }
+    }
+
+    // the only pass that quantizes an HDR frame, a heatmap already wrote data so it is left alone
+    void ResolveHDR() {
+        if (!hdrTarget || heatmapMode != HeatmapMode::NoHeatmap) {
+            return;
+        }
+        TRACE_SCOPE("ResolveHDR");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        ToneMapOperator op = toneMapOperator;
+        ForEachRow(height, [&](i32 y, u32 worker) {
+            const u16* in = hdrColor.data() + y * width * 4;
+            u8* out = data + y * width * 4;
+            for (int x = 0; x < width; ++x, in += 4, out += 4) {
+                r32 c[4];
+                HalfToFloat4(in, c);
+                for (int i = 0; i < 3; ++i) {
+                    c[i] = Math::Clamp(ToneMap(c[i] * exposure, op), 0, 1);
+                }
+                out[0] = (u8)(Math::Clamp(c[3], 0, 1) * 255 + 0.5f);
+                out[1] = (u8)(c[2] * 255 + 0.5f);
+                out[2] = (u8)(c[1] * 255 + 0.5f);
+                out[3] = (u8)(c[0] * 255 + 0.5f);
+            }
+        });
 
+        stats.postMs += FrameStats::MillisecondsSince(start);
+    }
+
+    // the post filters add their time to the stats of the bitmap they are called on
     void FlushLightPass(Bitmap* destination) {
+        TRACE_SCOPE("FlushLightPass");
+        auto start = std::chrono::high_resolution_clock::now();
         v3 brightness(0.2126, 0.7152, 0.0722);
         v4 black(0, 0, 0, 0);
 
@@ -469,49 +1897,313 @@ struct Bitmap {
                 }
             }
         }
+        stats.postMs += FrameStats::MillisecondsSince(start);
     }
-    void FlushBlur(Bitmap* destination, i32 size) {
-        v4 black(0, 0, 0, 0);
-        for (int y = size / 2; y < height - (size / 2); ++y) {
-            for (int x = size / 2; x < width - (size / 2); ++x) {
-                v4 result(0, 0, 0, 0);
-
-                for (int i = -(size / 2); i < (size / 2); ++i) {
-                    int yi = y + i;
-                    if (yi >= height || yi < 0) {
-                        result = result + black;
-                        continue;
+    // box blur of width size (rounded up to odd so it stays centered), done as a horizontal and a vertical
+    // pass with running sums so the cost per pixel does not depend on size. Pixels near the border
+    // average only the taps that fall inside the image. passes > 1 repeats the box, 3 passes are
+    // close to a gaussian. destination may be this bitmap, both have to be HDR targets or neither
+    void FlushBlur(Bitmap* destination, i32 size, i32 passes = 1) {
+        TRACE_SCOPE("FlushBlur");
+        auto start = std::chrono::high_resolution_clock::now();
+        assert(destination->width == width && destination->height == height);
+        assert(destination->hdrTarget == hdrTarget);
+
+        i32 radius = std::max(size / 2, 0);
+        i32 rowSize = width * 4;
+
+        blurScratch.resize(rowSize * height);
+        blurTemporary.resize(rowSize * height);
+        r32* image = blurScratch.data();
+        r32* temporary = blurTemporary.data();
+
+        if (hdrTarget) {
+            for (int i = 0; i < rowSize * height; i += 4) {
+                HalfToFloat4(&hdrColor[i], image + i);
+            }
+        }
+        else {
+            for (int i = 0; i < rowSize * height; ++i) {
+                image[i] = data[i];
+            }
+        }
+
+        blurSums.resize(rowSize);
+        r32* sums = blurSums.data();
+        for (int pass = 0; pass < passes; ++pass) {
+            // horizontal, one window per channel slides along the row
+            for (int y = 0; y < height; ++y) {
+                const r32* in = image + y * rowSize;
+                r32* out = temporary + y * rowSize;
+                r32 sum[4] = { 0, 0, 0, 0 };
+                for (int x = 0; x < std::min(radius, width); ++x) {
+                    for (int c = 0; c < 4; ++c) {
+                        sum[c] += in[x * 4 + c];
+                    }
+                }
+                for (int x = 0; x < width; ++x) {
+                    i32 enter = x + radius;
+                    i32 leave = x - radius - 1;
+                    if (enter < width) {
+                        for (int c = 0; c < 4; ++c) {
+                            sum[c] += in[enter * 4 + c];
+                        }
+                    }
+                    if (leave >= 0) {
+                        for (int c = 0; c < 4; ++c) {
+                            sum[c] -= in[leave * 4 + c];
+                        }
+                    }
+                    r32 taps = std::min(enter, width - 1) - std::max(x - radius, 0) + 1;
+                    for (int c = 0; c < 4; ++c) {
+                        out[x * 4 + c] = sum[c] / taps;
+                    }
+                }
+            }
+
+            // vertical, whole rows enter and leave the window so memory is walked in order
+            std::fill(sums, sums + rowSize, 0.0f);
+            for (int y = 0; y < std::min(radius, height); ++y) {
+                const r32* in = temporary + y * rowSize;
+                for (int i = 0; i < rowSize; ++i) {
+                    sums[i] += in[i];
+                }
+            }
+            for (int y = 0; y < height; ++y) {
+                i32 enter = y + radius;
+                i32 leave = y - radius - 1;
+                if (enter < height) {
+                    const r32* in = temporary + enter * rowSize;
+                    for (int i = 0; i < rowSize; ++i) {
+                        sums[i] += in[i];
+                    }
+                }
+                if (leave >= 0) {
+                    const r32* in = temporary + leave * rowSize;
+                    for (int i = 0; i < rowSize; ++i) {
+                        sums[i] -= in[i];
                     }
-                    for (int j = -(size / 2); j < (size / 2); ++j) {
-                        int xj = x + j;
-                        if (xj >= width || xj < 0) {
-                            result = result + black;
-                            continue;
+                }
+                r32 invTaps = 1.0f / (std::min(enter, height - 1) - std::max(y - radius, 0) + 1);
+                r32* out = image + y * rowSize;
+                for (int i = 0; i < rowSize; ++i) {
+                    out[i] = sums[i] * invTaps;
+                }
+            }
+        }
+
+        if (hdrTarget) {
+            for (int i = 0; i < rowSize * height; i += 4) {
+                FloatToHalf4(image + i, &destination->hdrColor[i]);
+            }
+        }
+        else {
+            for (int i = 0; i < rowSize * height; ++i) {
+                destination->data[i] = (u8)std::min(std::max(image[i] + 0.5f, 0.0f), 255.0f);
+            }
+        }
+
+        stats.postMs += FrameStats::MillisecondsSince(start);
+    }
+
+    // three box passes whose combined variance matches sigma
+    void FlushGaussianBlur(Bitmap* destination, r32 sigma) {
+        const i32 passes = 3;
+        r32 idealSize = std::sqrt(12.0f * sigma * sigma / passes + 1);
+        i32 radius = std::max((i32)std::round((idealSize - 1) / 2), 0);
+        FlushBlur(destination, radius * 2 + 1, passes);
+    }
+
+    // kept around so blurring every frame does not allocate
+    std::vector<r32> blurScratch;
+    std::vector<r32> blurTemporary;
+    std::vector<r32> blurSums;
+
+    // 1 runs the bright pass at half resolution, 2 at quarter
+    i32 bloomResolutionShift = 1;
+    i32 bloomLevelCount = 4;
+    // same luminance cut FlushLightPass uses, on an HDR target anything brighter than 1 passes too
+    r32 bloomThreshold = 0.3f;
+    r32 bloomIntensity = 1.0f;
+    std::vector<BloomLevel> bloomLevels;
+    // one row per worker, plus the horizontal filter taps of the upsample in flight
+    std::vector<r32> bloomRows;
+    std::vector<i32> bloomColumns;
+    std::vector<r32> bloomColumnWeights;
+
+    // light pass, blur and add in one go on this render target: the bright pass is folded into the first
+    // downsample, a chain of 2x2 downsamples and bilinear upsamples does the blurring at low resolution
+    // and the result is added back in the same pass that reads the frame. Only two passes touch the
+    // full resolution image and the levels are reused between frames
+    void Bloom() {
+        TRACE_SCOPE("Bloom");
+        auto start = std::chrono::high_resolution_clock::now();
+
+        i32 block = 1 << bloomResolutionShift;
+        bloomLevels.resize(std::max(bloomLevelCount, 1));
+        bloomLevels[0].Resize((width + block - 1) / block, (height + block - 1) / block);
+        for (u32 i = 1; i < bloomLevels.size(); ++i) {
+            bloomLevels[i].Resize(std::max((bloomLevels[i - 1].width + 1) / 2, 1), std::max((bloomLevels[i - 1].height + 1) / 2, 1));
+        }
+        bloomRows.resize(threadCount * width * 3);
+
+        // the threshold is compared against the luminance of the bytes, or of the halves on an HDR target
+        const r32 threshold = hdrTarget ? bloomThreshold : bloomThreshold * 255;
+        const r32 toFloat = hdrTarget ? 1.0f : 1.0f / 255.0f;
+
+        BloomLevel& first = bloomLevels[0];
+        ForEachRow(first.height, [&](i32 y, u32 worker) {
+            for (int x = 0; x < first.width; ++x) {
+                r32 sum[3] = { 0, 0, 0 };
+                i32 count = 0;
+                for (int sy = y * block; sy < std::min((y + 1) * block, height); ++sy) {
+                    for (int sx = x * block; sx < std::min((x + 1) * block, width); ++sx) {
+                        r32 c[4];
+                        if (hdrTarget) {
+                            HalfToFloat4(&hdrColor[(sx + sy * width) * 4], c);
+                        }
+                        else {
+                            const u8* pixel = data + (sx + sy * width) * 4;
+                            c[0] = pixel[3];
+                            c[1] = pixel[2];
+                            c[2] = pixel[1];
+                        }
+                        if (c[0] * 0.2126f + c[1] * 0.7152f + c[2] * 0.0722f > threshold) {
+                            sum[0] += c[0];
+                            sum[1] += c[1];
+                            sum[2] += c[2];
                         }
-                        v4 c = GetPixel(xj, yi);
+                        ++count;
+                    }
+                }
+                r32* out = &first.rgb[(x + y * first.width) * 3];
+                r32 scale = toFloat / count;
+                for (int c = 0; c < 3; ++c) {
+                    out[c] = sum[c] * scale;
+                }
+            }
+        });
+
+        for (u32 i = 1; i < bloomLevels.size(); ++i) {
+            const BloomLevel& source = bloomLevels[i - 1];
+            BloomLevel& target = bloomLevels[i];
+            for (int y = 0; y < target.height; ++y) {
+                i32 y0 = std::min(y * 2, source.height - 1);
+                i32 y1 = std::min(y * 2 + 1, source.height - 1);
+                for (int x = 0; x < target.width; ++x) {
+                    i32 x0 = std::min(x * 2, source.width - 1);
+                    i32 x1 = std::min(x * 2 + 1, source.width - 1);
+                    r32* out = &target.rgb[(x + y * target.width) * 3];
+                    for (int c = 0; c < 3; ++c) {
+                        out[c] = (source.rgb[(x0 + y0 * source.width) * 3 + c] + source.rgb[(x1 + y0 * source.width) * 3 + c] +
+                                  source.rgb[(x0 + y1 * source.width) * 3 + c] + source.rgb[(x1 + y1 * source.width) * 3 + c]) * 0.25f;
+                    }
+                }
+            }
+        }
+
+        // every level picks up the blurrier ones below it
+        for (i32 i = (i32)bloomLevels.size() - 2; i >= 0; --i) {
+            const BloomLevel& source = bloomLevels[i + 1];
+            BloomLevel& target = bloomLevels[i];
+            r32 scaleY = (r32)source.height / target.height;
+            SetupUpsampleColumns(source.width, target.width);
+            r32* row = bloomRows.data();
+            for (int y = 0; y < target.height; ++y) {
+                source.LerpRow((y + 0.5f) * scaleY, row);
+                r32* out = &target.rgb[y * target.width * 3];
+                for (int x = 0; x < target.width; ++x) {
+                    const r32* left = row + bloomColumns[x * 2 + 0] * 3;
+                    const r32* right = row + bloomColumns[x * 2 + 1] * 3;
+                    r32 fx = bloomColumnWeights[x];
+                    for (int c = 0; c < 3; ++c) {
+                        out[x * 3 + c] += left[c] + (right[c] - left[c]) * fx;
+                    }
+                }
+            }
+        }
 
-                        result = result + c;
+        r32 strength = bloomIntensity / bloomLevels.size() * (hdrTarget ? 1 : 255);
+        r32 scaleY = (r32)first.height / height;
+        SetupUpsampleColumns(first.width, width);
+        ForEachRow(height, [&](i32 y, u32 worker) {
+            r32* row = bloomRows.data() + worker * width * 3;
+            first.LerpRow((y + 0.5f) * scaleY, row);
+            if (hdrTarget) {
+                u16* pixel = hdrColor.data() + y * width * 4;
+                for (int x = 0; x < width; ++x, pixel += 4) {
+                    const r32* left = row + bloomColumns[x * 2 + 0] * 3;
+                    const r32* right = row + bloomColumns[x * 2 + 1] * 3;
+                    r32 fx = bloomColumnWeights[x];
+                    r32 c[4];
+                    HalfToFloat4(pixel, c);
+                    for (int i = 0; i < 3; ++i) {
+                        c[i] = std::min(c[i] + (left[i] + (right[i] - left[i]) * fx) * strength, HALF_MAX);
                     }
+                    FloatToHalf4(c, pixel);
                 }
+                return;
+            }
+            u8* pixel = data + y * width * 4;
+            for (int x = 0; x < width; ++x, pixel += 4) {
+                const r32* left = row + bloomColumns[x * 2 + 0] * 3;
+                const r32* right = row + bloomColumns[x * 2 + 1] * 3;
+                r32 fx = bloomColumnWeights[x];
+                pixel[3] = std::min(pixel[3] + (left[0] + (right[0] - left[0]) * fx) * strength, 255.0f);
+                pixel[2] = std::min(pixel[2] + (left[1] + (right[1] - left[1]) * fx) * strength, 255.0f);
+                pixel[1] = std::min(pixel[1] + (left[2] + (right[2] - left[2]) * fx) * strength, 255.0f);
+            }
+        });
 
-                result = result / (size * size);
+        stats.postMs += FrameStats::MillisecondsSince(start);
+    }
+
+    // horizontal half of the bilinear upsample, the same two taps and weight serve every row
+    void SetupUpsampleColumns(i32 sourceWidth, i32 targetWidth) {
+        bloomColumns.resize(targetWidth * 2);
+        bloomColumnWeights.resize(targetWidth);
+        r32 scale = (r32)sourceWidth / targetWidth;
+        for (int x = 0; x < targetWidth; ++x) {
+            r32 sx = (x + 0.5f) * scale - 0.5f;
+            i32 x0 = (i32)std::floor(sx);
+            bloomColumnWeights[x] = sx - x0;
+            bloomColumns[x * 2 + 0] = std::min(std::max(x0, 0), sourceWidth - 1);
+            bloomColumns[x * 2 + 1] = std::min(std::max(x0 + 1, 0), sourceWidth - 1);
+        }
+    }
 
-                destination->SetPixelToRGBA(x, y, result);
+    // runs function(row, worker) for every row, spread over the worker pool when there is one
+    void ForEachRow(i32 rows, const std::function<void(i32, u32)>& function) {
+        if (!workerPool) {
+            for (int y = 0; y < rows; ++y) {
+                function(y, 0);
             }
+            return;
         }
+
+        const i32 rowsPerJob = 16;
+        workerPool->Dispatch((rows + rowsPerJob - 1) / rowsPerJob, [&](u32 job, u32 worker) {
+            i32 end = std::min(rows, (i32)(job + 1) * rowsPerJob);
+            for (int y = job * rowsPerJob; y < end; ++y) {
+                function(y, worker);
+            }
+        });
     }
 
     void AddBitmap(Bitmap* a) {
+        TRACE_SCOPE("AddBitmap");
+        auto start = std::chrono::high_resolution_clock::now();
         for (int y = 0; y < height; ++y) {
             for (int x = 0; x < width; ++x) {
                 v4 c0 = GetPixelABGRToRGBA(x, y);
-                v4 c1 = a->GetPixel(x, y);
+                v4 c1 = a->hdrTarget ? a->GetPixelHDR(x, y) : a->GetPixel(x, y);
 
                 v4 c = c0 + c1;
 
                 SetPixel(x, y, c);
             }
         }
+        stats.postMs += FrameStats::MillisecondsSince(start);
     }
 
     v4 GetPixel(int x, int y){
@@ -525,10 +2217,19 @@ struct Bitmap {
         return v4(r, g, b, a);
     }
 
+    v4 GetPixelHDR(int x, int y){
+        r32 c[4];
+        HalfToFloat4(&hdrColor[(x + y * width) * 4], c);
+        return v4(c[0], c[1], c[2], c[3]);
+    }
+
     v4 GetPixelABGRToRGBA(int x, int y){
         if(x < 0 || x >= width || y < 0 || y>= height){
             assert(false);
         }
+        if(hdrTarget){
+            return GetPixelHDR(x, y);
+        }
         r32 a = data[x * 4 + y * width * 4 + 0] / 255.0;
         r32 b = data[x * 4 + y * width * 4 + 1] / 255.0;
         r32 g = data[x * 4 + y * width * 4 + 2] / 255.0;
@@ -566,7 +2267,22 @@ struct Bitmap {
         Line(aa, bb, color);
     }
 
+    // starts a new frame as far as stats are concerned
     void Clear(const v3& color){
+        stats = {};
+        if (heatmapMode != HeatmapMode::NoHeatmap) {
+            heatmap.assign(width * height, 0);
+        }
+        if (depthBuffer) {
+            ResetHierarchicalDepth(1);
+        }
+        if (hdrTarget) {
+            hdrColor.resize(width * height * 4);
+            u16 clear[4] = { FloatToHalf(color.x), FloatToHalf(color.y), FloatToHalf(color.z), FloatToHalf(1) };
+            for (int i = 0; i < width * height * 4; i += 4) {
+                memcpy(&hdrColor[i], clear, sizeof(clear));
+            }
+        }
         for(int i = 0; i < width * height * 4; i += 4){
             if (depthBuffer) {
                 depthBuffer[i / 4] = 1;
@@ -583,6 +2299,10 @@ struct Bitmap {
         if (x < 0 || x >= width || y < 0 || y >= height) {
             return;
         }
+        if (hdrTarget) {
+            SetPixelHDR(x, y, c);
+            return;
+        }
 
         c.x = Math::Clamp(c.x, 0, 1);
         c.y = Math::Clamp(c.y, 0, 1);
@@ -596,6 +2316,29 @@ struct Bitmap {
     }
 
     void SetPixel(int x, int y, v4 c){
+        if(hdrTarget){
+            if(x >= 0 && x < width && y >= 0 && y < height){
+                SetPixelHDR(x, y, c);
+            }
+            return;
+        }
+        SetPixelLDR(x, y, c);
+    }
+
+    // negative color is clamped away (max with 0 first so nan becomes 0 too), there is no upper limit
+    // below what a half can hold
+    void SetPixelHDR(int x, int y, v4 c){
+        r32 linear[4] = {
+            std::min(std::max(0.0f, c.x), HALF_MAX),
+            std::min(std::max(0.0f, c.y), HALF_MAX),
+            std::min(std::max(0.0f, c.z), HALF_MAX),
+            Math::Clamp(c.w, 0, 1)
+        };
+        FloatToHalf4(linear, &hdrColor[(x + y * width) * 4]);
+    }
+
+    // always writes the 8 bit target
+    void SetPixelLDR(int x, int y, v4 c){
         if(x < 0 || x >= width || y < 0 || y >= height){
             return;
         }
@@ -1,4 +1,13 @@
 g++ -o a -std=c++17 \
-    *.cpp \
-    -O3 \
-    -D_THREAD_SAFE -I/opt/homebrew/include -I/opt/homebrew/include/SDL2 -L/opt/homebrew/lib -lSDL2
\ No newline at end of file
+    app.cpp bitmap.cpp \
+    -O3 -pthread \
+    -D_THREAD_SAFE -I/opt/homebrew/include -I/opt/homebrew/include/SDL2 -L/opt/homebrew/lib -lSDL2
+
+g++ -o headless -std=c++17 \
+    headless.cpp bitmap.cpp \
+    -O3 -pthread \
+    -I/opt/homebrew/include -L/opt/homebrew/lib
+
+g++ -o bench -std=c++17 \
+    bench.cpp bitmap.cpp \
+    -O3 -pthread
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <string.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// IEEE 754 binary16, rounded to nearest even. Used for the HDR color target where a full float per
+// channel would double the memory traffic for no visible gain.
+
+// largest finite half
+#define HALF_MAX 65504.0f
+
+inline u16 FloatToHalf(r32 value) {
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    u32 sign = (bits >> 16) & 0x8000;
+    u32 magnitude = bits & 0x7fffffff;
+
+    // infinity and nan, nan keeps a mantissa bit so it stays a nan
+    if (magnitude >= 0x7f800000) {
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    // too large even before rounding
+    if (magnitude >= 0x47800000) {
+        return sign | 0x7c00;
+    }
+
+    // below the smallest normal half, the implicit bit becomes part of a denormal mantissa
+    if (magnitude < 0x38800000) {
+        if (magnitude < 0x33000000) {
+            return sign;
+        }
+        u32 exponent = magnitude >> 23;
+        u32 mantissa = (magnitude & 0x7fffff) | 0x800000;
+        u32 shift = 126 - exponent;
+        u32 half = mantissa >> shift;
+        u32 remainder = mantissa & ((1u << shift) - 1);
+        u32 halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) {
+            ++half;
+        }
+        return sign | half;
+    }
+
+    // rebias the exponent from 127 to 15, a carry out of the mantissa rounds up into the exponent
+    u32 half = (magnitude - 0x38000000) >> 13;
+    u32 remainder = magnitude & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return sign | half;
+}
+
+inline r32 HalfToFloat(u16 half) {
+    u32 sign = (u32)(half & 0x8000) << 16;
+    u32 exponent = (half >> 10) & 0x1f;
+    u32 mantissa = half & 0x3ff;
+
+    u32 bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent == 0) {
+        r32 value = mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    r32 result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// a whole pixel at a time, with F16C this is one instruction each way
+inline void FloatToHalf4(const r32* in, u16* out) {
+#if defined(__F16C__)
+    _mm_storel_epi64((__m128i*)out, _mm_cvtps_ph(_mm_loadu_ps(in), _MM_FROUND_TO_NEAREST_INT));
+#else
+    for (int i = 0; i < 4; ++i) {
+        out[i] = FloatToHalf(in[i]);
+    }
+#endif
+}
+
+inline void HalfToFloat4(const u16* in, r32* out) {
+#if defined(__F16C__)
+    _mm_storeu_ps(out, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)in)));
+#else
+    for (int i = 0; i < 4; ++i) {
+        out[i] = HalfToFloat(in[i]);
+    }
+#endif
+}
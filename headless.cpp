@@ -0,0 +1,330 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.hpp"
+#include "math.hpp"
+#include "global.hpp"
+
+#include "material.hpp"
+#include "mesh.hpp"
+#include "assimp_wrapper.hpp"
+#include "trace.hpp"
+
+// Renders a model without a window, frames go to <output>_0000.<ext>, <output>_0001.<ext>, ...
+//
+//   headless <model> [-frames N] [-size WIDTHxHEIGHT] [-format ppm|png|raw|none]
+//            [-output PREFIX] [-threads N] [-animation INDEX] [-stats PATH]
+//            [-heatmap fragments|depth|cycles] [-trace PATH] [-hdr clamp|reinhard|aces] [-exposure E]
+//            [-filter nearest|bilinear|trilinear] [-layout rowmajor|tiled] [-texels rgba8|float]
+//            [-skinning linear|dualquat]
+//
+// -stats writes the pipeline stats of every frame, as JSON when PATH ends in .json and CSV otherwise.
+// -heatmap writes overdraw, failed depth tests or shading cycles per pixel instead of the shaded image.
+// -trace writes a Chrome trace of the run, only available when built with -DENABLE_TRACING.
+// -hdr shades into a half float target and tone maps it with the given operator when the frame is written.
+// -texels stores every loaded texture as bytes or floats, normal maps included since the importer does not
+// tell them apart.
+
+static void PrintUsage() {
+    std::cout << "usage: headless <model> [-frames N] [-size WIDTHxHEIGHT] [-format ppm|png|raw|none]" << std::endl;
+    std::cout << "                [-output PREFIX] [-threads N] [-animation INDEX] [-stats PATH]" << std::endl;
+    std::cout << "                [-heatmap fragments|depth|cycles] [-trace PATH] [-hdr clamp|reinhard|aces] [-exposure E]" << std::endl;
+    std::cout << "                [-filter nearest|bilinear|trilinear] [-layout rowmajor|tiled] [-texels rgba8|float]" << std::endl;
+    std::cout << "                [-skinning linear|dualquat]" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string modelPath = argv[1];
+    int frames = 60;
+    int width = 340;
+    int height = 340;
+    std::string formatName = "ppm";
+    std::string output = "frame";
+    int threads = std::thread::hardware_concurrency();
+    int animationIndex = 0;
+    std::string statsPath;
+    HeatmapMode heatmapMode = HeatmapMode::NoHeatmap;
+    std::string tracePath;
+    bool hdr = false;
+    ToneMapOperator toneMapOperator = ToneMapOperator::ACESFilmic;
+    r32 exposure = 1.0f;
+    TextureFilter textureFilter = TextureFilter::Nearest;
+    SkinningMode skinningMode = SkinningMode::LinearBlend;
+
+    for (int i = 2; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "-frames") && hasValue) {
+            frames = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-size") && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-format") && hasValue) {
+            formatName = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-output") && hasValue) {
+            output = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-threads") && hasValue) {
+            threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-animation") && hasValue) {
+            animationIndex = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-stats") && hasValue) {
+            statsPath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-trace") && hasValue) {
+            tracePath = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-skinning") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "linear")) {
+                skinningMode = SkinningMode::LinearBlend;
+            }
+            else if (!strcmp(argv[i], "dualquat")) {
+                skinningMode = SkinningMode::DualQuaternion;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-filter") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "nearest")) {
+                textureFilter = TextureFilter::Nearest;
+            }
+            else if (!strcmp(argv[i], "bilinear")) {
+                textureFilter = TextureFilter::Bilinear;
+            }
+            else if (!strcmp(argv[i], "trilinear")) {
+                textureFilter = TextureFilter::Trilinear;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-layout") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "rowmajor")) {
+                Bitmap::loadLayout = TextureLayout::RowMajor;
+            }
+            else if (!strcmp(argv[i], "tiled")) {
+                Bitmap::loadLayout = TextureLayout::Tiled;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-texels") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "rgba8")) {
+                Bitmap::loadFormat = TexelFormat::RGBA8;
+            }
+            else if (!strcmp(argv[i], "float")) {
+                Bitmap::loadFormat = TexelFormat::RGBA32F;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-exposure") && hasValue) {
+            exposure = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-hdr") && hasValue) {
+            ++i;
+            hdr = true;
+            if (!strcmp(argv[i], "clamp")) {
+                toneMapOperator = ToneMapOperator::NoToneMap;
+            }
+            else if (!strcmp(argv[i], "reinhard")) {
+                toneMapOperator = ToneMapOperator::Reinhard;
+            }
+            else if (!strcmp(argv[i], "aces")) {
+                toneMapOperator = ToneMapOperator::ACESFilmic;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-heatmap") && hasValue) {
+            ++i;
+            if (!strcmp(argv[i], "fragments")) {
+                heatmapMode = HeatmapMode::ShadedFragments;
+            }
+            else if (!strcmp(argv[i], "depth")) {
+                heatmapMode = HeatmapMode::FailedDepthTests;
+            }
+            else if (!strcmp(argv[i], "cycles")) {
+                heatmapMode = HeatmapMode::ShadingCycles;
+            }
+            else {
+                PrintUsage();
+                return 1;
+            }
+        }
+        else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    ImageFormat format = ImageFormat::PPM;
+    bool writeFrames = true;
+    if (formatName == "png") {
+        format = ImageFormat::PNG;
+    }
+    else if (formatName == "raw") {
+        format = ImageFormat::Raw;
+    }
+    else if (formatName == "none") {
+        writeFrames = false;
+    }
+    else if (formatName != "ppm") {
+        PrintUsage();
+        return 1;
+    }
+
+    if (width <= 0 || height <= 0 || frames <= 0) {
+        PrintUsage();
+        return 1;
+    }
+
+    Viewport::width = width;
+    Viewport::height = height;
+
+    Bitmap bitmap;
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.data = new u8[width * height * 4];
+    bitmap.depthBuffer = new r32[width * height];
+    bitmap.InitializePerspective(20, 0.1f, 100.0f);
+    bitmap.SetThreadCount(threads);
+    bitmap.heatmapMode = heatmapMode;
+    bitmap.SetHDRTarget(hdr);
+    bitmap.toneMapOperator = toneMapOperator;
+    bitmap.exposure = exposure;
+    bitmap.textureFilter = textureFilter;
+    bitmap.skinningMode = skinningMode;
+
+    Mesh* mesh = AssimpImportModel(modelPath);
+    if (!mesh) {
+        std::cout << "Could not load " << modelPath << std::endl;
+        return 1;
+    }
+
+    const char* extension = format == ImageFormat::PNG ? "png" : (format == ImageFormat::Raw ? "raw" : "ppm");
+
+    // same framing as the interactive viewer with the camera left at its start
+    constexpr m4 s0 = m4::Scale(v3(0.01, 0.01, 0.01));
+    constexpr m4 t0 = m4::Translation(v3(0, -1, 5));
+    m4 r0 = m4::Rotation(180, Axis::Y);
+
+    bitmap.SetViewTransform(m4::Translation(v3(0, 0, 0)) * m4::Rotation(0, Axis::Y));
+    bitmap.SetModelTransform(t0 * r0 * s0);
+
+    Animation* animation = nullptr;
+    if (mesh->animations.size() > 0) {
+        animationIndex = Math::Clamp(animationIndex, 0, mesh->animations.size() - 1);
+        auto it = mesh->animations.begin();
+        std::advance(it, animationIndex);
+        animation = it->second;
+    }
+
+    FILE* statsFile = nullptr;
+    bool statsJSON = statsPath.size() >= 5 && statsPath.compare(statsPath.size() - 5, 5, ".json") == 0;
+    if (!statsPath.empty()) {
+        statsFile = fopen(statsPath.c_str(), "w");
+        if (!statsFile) {
+            std::cout << "Could not open " << statsPath << std::endl;
+            return 1;
+        }
+        if (statsJSON) {
+            fprintf(statsFile, "[\n");
+        }
+        else {
+            FrameStats::WriteCSVHeader(statsFile);
+        }
+    }
+
+    double renderSeconds = 0;
+    auto runStart = std::chrono::high_resolution_clock::now();
+
+    Trace::SetThreadName("Main");
+    for (int frame = 0; frame < frames; ++frame) {
+        TRACE_SCOPE("Frame");
+        auto frameStart = std::chrono::high_resolution_clock::now();
+
+        bitmap.Clear(v3(0.1, 0.1, 0.1));
+
+        if (animation) {
+            {
+                TRACE_SCOPE("Animation::Advance");
+                animation->Advance(1);
+            }
+            TRACE_SCOPE("CreatePoseTransforms");
+            bitmap.UploadBones(animation->CreatePoseTransforms());
+        }
+
+        bitmap.time = frame * 0.1;
+        bitmap.DrawTriangles(mesh->vertices, mesh->indices, mesh->materials);
+        bitmap.ResolveHDR();
+
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+        renderSeconds += std::chrono::duration<double>(frameEnd - frameStart).count();
+
+        if (statsFile && statsJSON) {
+            fprintf(statsFile, frame ? ",\n  " : "  ");
+            bitmap.stats.WriteJSON(statsFile, frame);
+        }
+        else if (statsFile) {
+            bitmap.stats.WriteCSV(statsFile, frame);
+        }
+
+        if (writeFrames) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s_%04d.%s", output.c_str(), frame, extension);
+            if (!bitmap.SaveToFile(path, format)) {
+                return 1;
+            }
+        }
+    }
+
+    if (statsFile) {
+        if (statsJSON) {
+            fprintf(statsFile, "\n]\n");
+        }
+        fclose(statsFile);
+    }
+
+    auto runEnd = std::chrono::high_resolution_clock::now();
+
+    if (!tracePath.empty() && !Trace::WriteChromeJSON(tracePath.c_str())) {
+        std::cout << "Could not write " << tracePath << ", tracing needs -DENABLE_TRACING" << std::endl;
+    }
+    double totalSeconds = std::chrono::duration<double>(runEnd - runStart).count();
+
+    std::cout << frames << " frames at " << width << "x" << height << " on " << bitmap.threadCount << " threads" << std::endl;
+    std::cout << "render: " << frames / renderSeconds << " frames/sec (" << renderSeconds * 1000.0 / frames << " ms/frame)" << std::endl;
+    std::cout << "total with output: " << frames / totalSeconds << " frames/sec" << std::endl;
+
+    return 0;
+}
@@ -9,4 +9,14 @@ struct Material {
 	Bitmap metalic;
 	Bitmap ambientOcclusion;
 	Bitmap emissive;
-};
\ No newline at end of file
+
+	// normal maps can drop to two channels, the other maps share colorFormat
+	void ConvertTexels(TexelFormat colorFormat, TexelFormat normalFormat, TextureLayout layout) {
+		diffuse.ConvertTexels(colorFormat, layout);
+		normal.ConvertTexels(normalFormat, layout);
+		roughness.ConvertTexels(colorFormat, layout);
+		metalic.ConvertTexels(colorFormat, layout);
+		ambientOcclusion.ConvertTexels(colorFormat, layout);
+		emissive.ConvertTexels(colorFormat, layout);
+	}
+};
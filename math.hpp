@@ -1,6 +1,7 @@
 #pragma once
 
 #include "global.hpp"
+#include "simd.hpp"
 #include <cmath>
 #include <iostream>
 
@@ -8,12 +9,31 @@
 #define M_PI 3.14159265358979323846264338327950288
 #endif
 
+// true while the compiler folds a constexpr call. f32x4 can only run at run time, so the wide operations
+// fall back to plain arithmetic in the same order when they are evaluated at compile time
+#define MATH_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+
 enum Axis {
     X,
     Y,
     Z
 };
 
+// 1 / sqrt(x) for normalizing. Building with -DMATH_FAST_NORMALIZE uses the hardware estimate refined by one
+// Newton step instead, within a couple of ulps
+inline r32 ReciprocalSqrt(r32 x) {
+#ifdef MATH_FAST_NORMALIZE
+    f32x4 wide(x);
+    f32x4 estimate = f32x4::RSqrt(wide);
+    estimate = estimate * (f32x4(1.5f) - f32x4(0.5f) * wide * estimate * estimate);
+    r32 lanes[4];
+    estimate.Store(lanes);
+    return lanes[0];
+#else
+    return 1.0f / std::sqrt(x);
+#endif
+}
+
 struct v3 {
     union {
         struct {
@@ -24,70 +44,68 @@ struct v3 {
         r32 m[3];
     };
     v3() = default;
-    v3(r32 xx, r32 yy, r32 zz) : x(xx), y(yy), z(zz) {}
+    constexpr v3(r32 xx, r32 yy, r32 zz) : x(xx), y(yy), z(zz) {}
 
-    static v3 Cross(v3 a, v3 b) {
-        v3 result;
-        result.x = a.y * b.z - a.z * b.y;
-        result.y = a.z * b.x - a.x * b.z;
-        result.z = a.x * b.y - a.y * b.x;
-        return result;
+    static constexpr v3 Cross(v3 a, v3 b) {
+        return v3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
     }
 
-    static v3 Perp(v3 v) {
+    static constexpr v3 Perp(v3 v) {
         // z is unused
         return v3(-v.y, v.x, 0);
     }
 
-    static v3 Min(v3 a, v3 b) {
+    static constexpr v3 Min(v3 a, v3 b) {
         int minx = a.x < b.x ? a.x : b.x;
         int miny = a.y < b.y ? a.y : b.y;
         int minz = a.z < b.z ? a.z : b.z;
         return v3(minx, miny, minz);
     }
-    static v3 Max(v3 a, v3 b) {
+    static constexpr v3 Max(v3 a, v3 b) {
         int maxx = a.x > b.x ? a.x : b.x;
         int maxy = a.y > b.y ? a.y : b.y;
         int maxz = a.z > b.z ? a.z : b.z;
         return v3(maxx, maxy, maxz);
     }
 
-    static v3 Clamp(const v3& v, r32 min, r32 max);
+    static constexpr v3 Clamp(const v3& v, r32 min, r32 max);
 
     r32 Length() {
         return std::sqrt(x * x + y * y + z * z);
     }
 
     v3 Normalized() {
-        r32 length = Length();
-        return v3(x / length, y / length, z / length);
+        r32 invLength = ReciprocalSqrt(x * x + y * y + z * z);
+        return v3(x * invLength, y * invLength, z * invLength);
     }
 
-    static v3 Lerp(v3 a, v3 b, r32 t);
+    static constexpr v3 Lerp(v3 a, v3 b, r32 t) {
+        return a * (1.0 - t) + b * t;
+    }
 
-    v3 operator-() {
+    constexpr v3 operator-() const {
         return v3(-x, -y, -z);
     }
 
-    v3 operator-(v3 b) {
+    constexpr v3 operator-(v3 b) const {
         return v3(x - b.x, y - b.y, z - b.z);
     }
-    v3 operator+(v3 b) {
+    constexpr v3 operator+(v3 b) const {
         return v3(x + b.x, y + b.y, z + b.z);
     }
-    v3 operator*(v3 b) {
+    constexpr v3 operator*(v3 b) const {
         return v3(x * b.x, y * b.y, z * b.z);
     }
-    v3 operator*(r32 b) const {
+    constexpr v3 operator*(r32 b) const {
         return v3(x * b, y * b, z * b);
     }
-    v3 operator/(r32 b) {
+    constexpr v3 operator/(r32 b) const {
         return v3(x / b, y / b, z / b);
     }
-    v3 operator+(r32 b) {
+    constexpr v3 operator+(r32 b) const {
         return v3(x + b, y + b, z + b);
     }
-    v3 operator-(r32 b) {
+    constexpr v3 operator-(r32 b) const {
         return v3(x - b, y - b, z - b);
     }
 };
@@ -102,11 +120,12 @@ struct v4i {
         };
         i32 m[4];
     };
-    v4i() :v4i(0, 0, 0, 0) {}
-    v4i(i32 x, i32 y, i32 z, i32 w) :x(x), y(y), z(z), w(w) {}
+    constexpr v4i() :v4i(0, 0, 0, 0) {}
+    constexpr v4i(i32 x, i32 y, i32 z, i32 w) :x(x), y(y), z(z), w(w) {}
 };
 
-struct v4 {
+// aligned so the arithmetic loads and stores it as one f32x4
+struct alignas(16) v4 {
     union {
         struct {
             r32 x;
@@ -117,38 +136,69 @@ struct v4 {
         r32 m[4];
     };
     v4() = default;
-    v4(r32 xx, r32 yy, r32 zz, r32 ww) : x(xx), y(yy), z(zz), w(ww) {}
-    v4(const v3& o) : x(o.x), y(o.y), z(o.z), w(0) {}
+    constexpr v4(r32 xx, r32 yy, r32 zz, r32 ww) : x(xx), y(yy), z(zz), w(ww) {}
+    constexpr v4(const v3& o) : x(o.x), y(o.y), z(o.z), w(0) {}
+    v4(f32x4 wide) {
+        wide.StoreAligned(m);
+    }
+
+    f32x4 Wide() const {
+        return f32x4::LoadAligned(m);
+    }
 
     r32 Length() {
         return std::sqrt(x * x + y * y + z * z + w * w);
     }
 
     v4 Normalized() {
-        r32 length = Length();
-        return v4(x / length, y / length, z / length, w / length);
+        return Wide() * f32x4(ReciprocalSqrt(x * x + y * y + z * z + w * w));
+    }
+
+    // lane i without going through m, which constant evaluation can not read while x y z w are the active members
+    constexpr r32 Lane(int i) const {
+        return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w));
     }
 
-    static v4 Lerp(v4 a, v4 b, r32 t);
+    static constexpr v4 Lerp(v4 a, v4 b, r32 t) {
+        return a * (1.0 - t) + b * t;
+    }
     static v4 Slerp(v4 a, v4 b, r32 t);
 
-    v4 operator/(r32 r) {
-        return v4(x / r, y / r, z / r, w / r);
+    constexpr v4 operator/(r32 r) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(x / r, y / r, z / r, w / r);
+        }
+        return Wide() / f32x4(r);
     }
-    v4 operator-() {
-        return v4(-x, -y, -z, -w);
+    constexpr v4 operator-() const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(-x, -y, -z, -w);
+        }
+        return f32x4(0.0f) - Wide();
     }
-    v4 operator-(v4 b) {
-        return v4(x - b.x, y - b.y, z - b.z, w - b.w);
+    constexpr v4 operator-(v4 b) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(x - b.x, y - b.y, z - b.z, w - b.w);
+        }
+        return Wide() - b.Wide();
     }
-    v4 operator+(v4 b) {
-        return v4(x + b.x, y + b.y, z + b.z, w + b.w);
+    constexpr v4 operator+(v4 b) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(x + b.x, y + b.y, z + b.z, w + b.w);
+        }
+        return Wide() + b.Wide();
     }
-    v4 operator*(v4 b) {
-        return v4(x * b.x, y * b.y, z * b.z, w * b.w);
+    constexpr v4 operator*(v4 b) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(x * b.x, y * b.y, z * b.z, w * b.w);
+        }
+        return Wide() * b.Wide();
     }
-    v4 operator*(r32 b) const {
-        return v4(x * b, y * b, z * b, w * b);
+    constexpr v4 operator*(r32 b) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            return v4(x * b, y * b, z * b, w * b);
+        }
+        return Wide() * f32x4(b);
     }
 };
 
@@ -156,14 +206,14 @@ struct v2 {
     r32 x;
     r32 y;
     v2() = default;
-    v2(r32 xx, r32 yy) : x(xx), y(yy) {}
+    constexpr v2(r32 xx, r32 yy) : x(xx), y(yy) {}
 
-    static v2 Min(v2 a, v2 b) {
+    static constexpr v2 Min(v2 a, v2 b) {
         int minx = a.x < b.x ? a.x : b.x;
         int miny = a.y < b.y ? a.y : b.y;
         return v2(minx, miny);
     }
-    static v2 Max(v2 a, v2 b) {
+    static constexpr v2 Max(v2 a, v2 b) {
         int maxx = a.x > b.x ? a.x : b.x;
         int maxy = a.y > b.y ? a.y : b.y;
         return v2(maxx, maxy);
@@ -178,24 +228,26 @@ struct v2 {
         return v2(x / length, y / length);
     }
 
-    static v2 Lerp(v2 a, v2 b, r32 t);
+    static constexpr v2 Lerp(v2 a, v2 b, r32 t) {
+        return a * (1.0 - t) + b * t;
+    }
 
-    v2 operator-() {
+    constexpr v2 operator-() const {
         return v2(-x, -y);
     }
-    v2 operator-(v2 b) {
+    constexpr v2 operator-(v2 b) const {
         return v2(x - b.x, y - b.y);
     }
-    v2 operator+(v2 b) {
+    constexpr v2 operator+(v2 b) const {
         return v2(x + b.x, y + b.y);
     }
-    v2 operator*(v2 b) {
+    constexpr v2 operator*(v2 b) const {
         return v2(x * b.x, y * b.y);
     }
-    v2 operator*(r32 b) const {
+    constexpr v2 operator*(r32 b) const {
         return v2(x * b, y * b);
     }
-    v2 operator+(r32 b) {
+    constexpr v2 operator+(r32 b) const {
         return v2(x * b, y * b);
     }
 };
@@ -281,65 +333,40 @@ struct m4 {
         r32 m[4 * 4];
     };
 
-    m4() {
-        for (int i = 0; i < 4 * 4; ++i) {
-            m[i] = 0;
-        }
+    // the constructors set rows, so constant evaluation reads elements through rows[i].x and friends
+    // rather than m
+    constexpr m4() : m4(1) {}
 
-        m[0 + 0 * 4] = 1;
-        m[1 + 1 * 4] = 1;
-        m[2 + 2 * 4] = 1;
-        m[3 + 3 * 4] = 1;
-    }
+    constexpr m4(const m3& other) : rows{ other.rows[0], other.rows[1], other.rows[2], v4(0, 0, 0, 1) } {}
 
-    m4(const m3& other) {
-        rows[0] = other.rows[0];
-        rows[1] = other.rows[1];
-        rows[2] = other.rows[2];
-        rows[3] = v4(0, 0, 0, 1);
-    }
+    constexpr m4(r32 scale) : rows{ v4(scale, 0, 0, 0), v4(0, scale, 0, 0), v4(0, 0, scale, 0), v4(0, 0, 0, scale) } {}
 
-    m4(r32 scale) {
-        for (int i = 0; i < 4 * 4; ++i) {
-            m[i] = 0;
-        }
-
-        m[0 + 0 * 4] = scale;
-        m[1 + 1 * 4] = scale;
-        m[2 + 2 * 4] = scale;
-        m[3 + 3 * 4] = scale;
-    }
-
-    m4(r32 m0, r32 m1, r32 m2, r32 m3,
+    constexpr m4(r32 m0, r32 m1, r32 m2, r32 m3,
         r32 m4, r32 m5, r32 m6, r32 m7,
         r32 m8, r32 m9, r32 m10, r32 m11,
-        r32 m12, r32 m13, r32 m14, r32 m15) {
-
-        m[0] = m0;
-        m[1] = m1;
-        m[2] = m2;
-        m[3] = m3;
-        m[4] = m4;
-        m[5] = m5;
-        m[6] = m6;
-        m[7] = m7;
-        m[8] = m8;
-        m[9] = m9;
-        m[10] = m10;
-        m[11] = m11;
-        m[12] = m12;
-        m[13] = m13;
-        m[14] = m14;
-        m[15] = m15;
-    }
-
-    m4 Transpose() {
-        m4 result;
-        for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 4; ++j) {
-                result.m[j + i * 4] = m[i + j * 4];
+        r32 m12, r32 m13, r32 m14, r32 m15)
+        : rows{ v4(m0, m1, m2, m3), v4(m4, m5, m6, m7), v4(m8, m9, m10, m11), v4(m12, m13, m14, m15) } {}
+
+    constexpr m4 Transpose() const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            m4 result;
+            for (int i = 0; i < 4; ++i) {
+                result.rows[i] = v4(rows[0].Lane(i), rows[1].Lane(i), rows[2].Lane(i), rows[3].Lane(i));
             }
+            return result;
         }
+
+        f32x4 r0 = rows[0].Wide();
+        f32x4 r1 = rows[1].Wide();
+        f32x4 r2 = rows[2].Wide();
+        f32x4 r3 = rows[3].Wide();
+        f32x4::Transpose(r0, r1, r2, r3);
+
+        m4 result;
+        result.rows[0] = r0;
+        result.rows[1] = r1;
+        result.rows[2] = r2;
+        result.rows[3] = r3;
         return result;
     }
 
@@ -435,98 +462,283 @@ struct m4 {
         return result;
     }
 
-    static m4 Translation(v3 p) {
-        m4 result;
-
-        result.rows[0] = v4(1, 0, 0, p.x);
-        result.rows[1] = v4(0, 1, 0, p.y);
-        result.rows[2] = v4(0, 0, 1, p.z);
-        result.rows[3] = v4(0, 0, 0, 1);
+    static constexpr m4 Translation(v3 p) {
+        return m4(1, 0, 0, p.x,
+                  0, 1, 0, p.y,
+                  0, 0, 1, p.z,
+                  0, 0, 0, 1);
+    }
 
-        return result;
+    static constexpr m4 Scale(v3 scale) {
+        return m4(scale.x, 0, 0, 0,
+                  0, scale.y, 0, 0,
+                  0, 0, scale.z, 0,
+                  0, 0, 0, 1);
     }
 
-    static m4 Scale(v3 scale) {
-        m4 result;
+    // every row of the result is the rows of n weighted by one row of this, summed in the same order the
+    // scalar loop used so results only change where the target fuses the multiply adds
+    constexpr m4 operator*(m4 n) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            m4 result;
+            for (int i = 0; i < 4; ++i) {
+                v4 sum = n.rows[0] * rows[i].x;
+                sum = n.rows[1] * rows[i].y + sum;
+                sum = n.rows[2] * rows[i].z + sum;
+                sum = n.rows[3] * rows[i].w + sum;
+                result.rows[i] = sum;
+            }
+            return result;
+        }
 
-        result.rows[0] = v4(scale.x, 0, 0, 0);
-        result.rows[1] = v4(0, scale.y, 0, 0);
-        result.rows[2] = v4(0, 0, scale.z, 0);
-        result.rows[3] = v4(0, 0, 0, 1);
+        f32x4 n0 = n.rows[0].Wide();
+        f32x4 n1 = n.rows[1].Wide();
+        f32x4 n2 = n.rows[2].Wide();
+        f32x4 n3 = n.rows[3].Wide();
 
+        m4 result;
+        for (int i = 0; i < 4; ++i) {
+            const r32* row = rows[i].m;
+            f32x4 sum = n0 * f32x4(row[0]);
+            sum = f32x4::MulAdd(n1, f32x4(row[1]), sum);
+            sum = f32x4::MulAdd(n2, f32x4(row[2]), sum);
+            sum = f32x4::MulAdd(n3, f32x4(row[3]), sum);
+            result.rows[i] = sum;
+        }
         return result;
     }
 
-    m4 operator*(m4 n) {
-        m4 result = {};
+    constexpr m4 operator*(r32 b) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            m4 result;
+            for (int i = 0; i < 4; ++i) {
+                result.rows[i] = rows[i] * b;
+            }
+            return result;
+        }
 
+        m4 result;
+        f32x4 scale(b);
         for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 4; ++j) {
-                result.m[j + i * 4] = 0;
-                for (int k = 0; k < 4; ++k) {
-                    result.m[j + i * 4] += m[k + i * 4] * n.m[j + k * 4];
-                }
-            }
+            result.rows[i] = rows[i].Wide() * scale;
         }
         return result;
     }
 
-    m4 operator*(r32 b) {
-        m4 result = {};
+    constexpr m4 operator+(m4 n) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            m4 result;
+            for (int i = 0; i < 4; ++i) {
+                result.rows[i] = rows[i] + n.rows[i];
+            }
+            return result;
+        }
 
+        m4 result;
         for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 4; ++j) {
-                result.m[j + i * 4] = m[j + i * 4] * b;
-            }
+            result.rows[i] = rows[i].Wide() + n.rows[i].Wide();
         }
         return result;
     }
 
-    m4 operator+(m4 n) {
-        m4 result = {};
+    // inverse of a transform with 0 0 0 1 as its last row: the 3x3 part inverted through its cofactors and
+    // the translation moved back through that
+    constexpr m4 AffineInverse() const {
+        v3 r0(rows[0].x, rows[0].y, rows[0].z);
+        v3 r1(rows[1].x, rows[1].y, rows[1].z);
+        v3 r2(rows[2].x, rows[2].y, rows[2].z);
+        v3 c0 = v3::Cross(r1, r2);
+        v3 c1 = v3::Cross(r2, r0);
+        v3 c2 = v3::Cross(r0, r1);
+        r32 invDeterminant = 1.0f / (r0.x * c0.x + r0.y * c0.y + r0.z * c0.z);
 
-        for (int i = 0; i < 4; ++i) {
-            for (int j = 0; j < 4; ++j) {
-                result.m[j + i * 4] = m[j + i * 4] + n.m[j + i * 4];
-            }
-        }
+        v3 i0 = v3(c0.x, c1.x, c2.x) * invDeterminant;
+        v3 i1 = v3(c0.y, c1.y, c2.y) * invDeterminant;
+        v3 i2 = v3(c0.z, c1.z, c2.z) * invDeterminant;
+        v3 t(rows[0].w, rows[1].w, rows[2].w);
+
+        // every row written once, patching w into a stored row stalls the wide load that reads it back
+        m4 result;
+        result.rows[0] = v4(i0.x, i0.y, i0.z, -(i0.x * t.x + i0.y * t.y + i0.z * t.z));
+        result.rows[1] = v4(i1.x, i1.y, i1.z, -(i1.x * t.x + i1.y * t.y + i1.z * t.z));
+        result.rows[2] = v4(i2.x, i2.y, i2.z, -(i2.x * t.x + i2.y * t.y + i2.z * t.z));
         return result;
     }
 
-    v4 operator*(v3 v) {
-        v4 vv(v.x, v.y, v.z, 1);
+    constexpr v4 operator*(v3 v) const {
+        return *this * v4(v.x, v.y, v.z, 1);
+    }
 
-        v4 result;
-        for (int i = 0; i < 4; ++i) {
-            result.m[i] = 0;
-            for (int j = 0; j < 4; ++j) {
-                result.m[i] += m[j + i * 4] * vv.m[j];
+    // the columns weighted by v, summed in the order of the scalar dot products
+    constexpr v4 operator*(v4 v) const {
+        if (MATH_CONSTANT_EVALUATED()) {
+            v4 result(0, 0, 0, 0);
+            for (int i = 0; i < 4; ++i) {
+                v4 column(rows[0].Lane(i), rows[1].Lane(i), rows[2].Lane(i), rows[3].Lane(i));
+                result = i ? column * v.Lane(i) + result : column * v.Lane(i);
             }
+            return result;
         }
+
+        f32x4 c0 = rows[0].Wide();
+        f32x4 c1 = rows[1].Wide();
+        f32x4 c2 = rows[2].Wide();
+        f32x4 c3 = rows[3].Wide();
+        f32x4::Transpose(c0, c1, c2, c3);
+
+        f32x4 result = c0 * f32x4(v.x);
+        result = f32x4::MulAdd(c1, f32x4(v.y), result);
+        result = f32x4::MulAdd(c2, f32x4(v.z), result);
+        result = f32x4::MulAdd(c3, f32x4(v.w), result);
         return result;
     }
 
-    v4 operator*(v4 v) {
-        v4 result;
-        for (int i = 0; i < 4; ++i) {
-            result.m[i] = 0;
-            for (int j = 0; j < 4; ++j) {
-                result.m[i] += m[j + i * 4] * v.m[j];
-            }
-        }
+};
+
+// a rigid transform in 32 bytes: a unit rotation quaternion and a dual part that holds the translation.
+// Both are stored x y z w, unlike the w first keys QuatToMat takes
+struct DualQuat {
+    v4 real = v4(0, 0, 0, 1);
+    v4 dual = v4(0, 0, 0, 0);
+
+    // q in the layout QuatToMat takes, so animation keys can be passed straight in
+    static constexpr DualQuat FromRotationTranslation(v4 q, v3 t) {
+        DualQuat result;
+        result.real = v4(q.y, q.z, q.w, q.x);
+        v3 r(result.real.x, result.real.y, result.real.z);
+        v3 d = (t * result.real.w + v3::Cross(t, r)) * 0.5f;
+        result.dual = v4(d.x, d.y, d.z, -0.5f * (t.x * r.x + t.y * r.y + t.z * r.z));
         return result;
     }
 
+    // the upper 3x3 has to be a rotation, any scale or shear in it is lost
+    static DualQuat FromMatrix(const m4& transform) {
+        const v4* r = transform.rows;
+        r32 trace = r[0].x + r[1].y + r[2].z;
+        r32 x, y, z, w;
+        if (trace > 0) {
+            r32 s = std::sqrt(trace + 1) * 2;
+            w = 0.25f * s;
+            x = (r[2].y - r[1].z) / s;
+            y = (r[0].z - r[2].x) / s;
+            z = (r[1].x - r[0].y) / s;
+        }
+        else if (r[0].x > r[1].y && r[0].x > r[2].z) {
+            r32 s = std::sqrt(1 + r[0].x - r[1].y - r[2].z) * 2;
+            w = (r[2].y - r[1].z) / s;
+            x = 0.25f * s;
+            y = (r[0].y + r[1].x) / s;
+            z = (r[0].z + r[2].x) / s;
+        }
+        else if (r[1].y > r[2].z) {
+            r32 s = std::sqrt(1 + r[1].y - r[0].x - r[2].z) * 2;
+            w = (r[0].z - r[2].x) / s;
+            x = (r[0].y + r[1].x) / s;
+            y = 0.25f * s;
+            z = (r[1].z + r[2].y) / s;
+        }
+        else {
+            r32 s = std::sqrt(1 + r[2].z - r[0].x - r[1].y) * 2;
+            w = (r[1].x - r[0].y) / s;
+            x = (r[0].z + r[2].x) / s;
+            y = (r[1].z + r[2].y) / s;
+            z = 0.25f * s;
+        }
+        return FromRotationTranslation(v4(w, x, y, z), v3(r[0].w, r[1].w, r[2].w));
+    }
 };
 
 namespace Math {
-    r32 Clamp(r32 v, r32 l, r32 h);
-    v3 NDCToSC(v3 v, r32 width, r32 height);
-
-    r32 Dot(v4 a, v4 b);
-    r32 Dot(v3 a, v3 b);
-    r32 Dot(v2 a, v2 b);
-    v3 Intersect(v3 point, v3 normal, v3 a, v3 b, r32* tt = nullptr);
-    v4 Intersect(v4 point, v4 normal, v4 a, v4 b, r32* tt = nullptr);
-    v3 Reflect(v3 vector, v3 normal);
+    constexpr r32 Clamp(r32 v, r32 l, r32 h) {
+        return v < l ? l : (v > h ? h : v);
+    }
+
+    constexpr v3 NDCToSC(v3 v, r32 width, r32 height) {
+        r32 halfWidth = width / 2.0f;
+        r32 halfHeight = height / 2.0f;
+
+        r32 x = (v.x * halfWidth + halfWidth);
+        r32 y = (-v.y * halfHeight + halfHeight);
+
+        return v3(x, y, v.z);
+    }
+
+    constexpr r32 Dot(v4 a, v4 b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+    }
+    constexpr r32 Dot(v3 a, v3 b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+    constexpr r32 Dot(v2 a, v2 b) {
+        return a.x * b.x + a.y * b.y;
+    }
+    constexpr v3 Intersect(v3 point, v3 normal, v3 a, v3 b, r32* tt = nullptr) {
+        r32 d0 = Dot(normal, (a - point));
+        r32 d1 = Dot(normal, (b - point));
+
+        r32 t = d0 / (d0 - d1);
+        if (tt) {
+            *tt = t;
+        }
+        return v3::Lerp(a, b, t);
+    }
+
+    constexpr v4 Intersect(v4 point, v4 normal, v4 a, v4 b, r32* tt = nullptr) {
+        r32 d0 = Dot(normal, (a - point));
+        r32 d1 = Dot(normal, (b - point));
+
+        r32 t = d0 / (d0 - d1);
+        if (tt) {
+            *tt = t;
+        }
+        return v4::Lerp(a, b, t);
+    }
+
+    constexpr v3 Reflect(v3 vector, v3 normal) {
+        return vector - normal * (2.0f * Dot(vector, normal));
+    }
+}
+
+constexpr v3 v3::Clamp(const v3& v, r32 min, r32 max) {
+    return v3(Math::Clamp(v.x, min, max), Math::Clamp(v.y, min, max), Math::Clamp(v.z, min, max));
+}
+
+inline v4 v4::Slerp(v4 a, v4 b, r32 t) {
+    r32 cosTheta = Math::Dot(a, b);
+    v4 c = b;
+    if (cosTheta < 0) {
+        c = -b;
+        cosTheta = -cosTheta;
+    }
+
+    if (cosTheta > 1 - 0.000001) {
+        return v4::Lerp(a, c, t);
+    }
+    else {
+        r32 angle = std::acos(cosTheta);
+        r32 invSin = 1 / std::sin(angle);
+        r32 c0 = std::sin((1 - t) * angle) * invSin;
+        r32 c1 = std::sin(t * angle) * invSin;
+
+        return a * c0 + c * c1;
+    }
+}
+
+inline std::ostream& operator<<(std::ostream& stream, v4& v) {
+    stream << "V " << std::endl;
+    for (int i = 0; i < 4; ++i) {
+        stream << v.m[i] << " ";
+        stream << std::endl;
+    }
+    return stream;
+}
+inline std::ostream& operator<<(std::ostream& stream, m4& m) {
+    stream << "M " << std::endl;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            stream << m.m[j + i * 4] << " ";
+        }
+        stream << std::endl;
+    }
+    return stream;
 }
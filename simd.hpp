@@ -0,0 +1,380 @@
+#pragma once
+
+#include "global.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define SIMD_SCALAR 1
+#include <cmath>
+#include <cstring>
+#endif
+
+// 4 lanes of r32, comparisons return masks with all bits of a lane set
+struct f32x4 {
+#if SIMD_SSE2
+    __m128 v;
+#elif SIMD_NEON
+    float32x4_t v;
+#else
+    r32 v[4];
+#endif
+
+    f32x4() = default;
+
+#if SIMD_SSE2
+    f32x4(__m128 vv) : v(vv) {}
+    f32x4(r32 s) : v(_mm_set1_ps(s)) {}
+    f32x4(r32 a, r32 b, r32 c, r32 d) : v(_mm_setr_ps(a, b, c, d)) {}
+
+    static f32x4 Load(const r32* p) { return _mm_loadu_ps(p); }
+    void Store(r32* p) const { _mm_storeu_ps(p, v); }
+    // p has to be 16 byte aligned
+    static f32x4 LoadAligned(const r32* p) { return _mm_load_ps(p); }
+    void StoreAligned(r32* p) const { _mm_store_ps(p, v); }
+
+    // four bytes scaled to [0, 1]
+    static f32x4 LoadUnorm8(const u8* p) {
+        i32 bits;
+        memcpy(&bits, p, sizeof(bits));
+        __m128i zero = _mm_setzero_si128();
+        __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero);
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), _mm_set1_ps(1.0f / 255.0f));
+    }
+
+    f32x4 operator+(f32x4 b) const { return _mm_add_ps(v, b.v); }
+    f32x4 operator-(f32x4 b) const { return _mm_sub_ps(v, b.v); }
+    f32x4 operator*(f32x4 b) const { return _mm_mul_ps(v, b.v); }
+    f32x4 operator/(f32x4 b) const { return _mm_div_ps(v, b.v); }
+
+    f32x4 operator<(f32x4 b) const { return _mm_cmplt_ps(v, b.v); }
+    f32x4 operator<=(f32x4 b) const { return _mm_cmple_ps(v, b.v); }
+    f32x4 operator>(f32x4 b) const { return _mm_cmpgt_ps(v, b.v); }
+    f32x4 operator>=(f32x4 b) const { return _mm_cmpge_ps(v, b.v); }
+
+    f32x4 operator&(f32x4 b) const { return _mm_and_ps(v, b.v); }
+    f32x4 operator|(f32x4 b) const { return _mm_or_ps(v, b.v); }
+
+    static f32x4 Min(f32x4 a, f32x4 b) { return _mm_min_ps(a.v, b.v); }
+    static f32x4 Max(f32x4 a, f32x4 b) { return _mm_max_ps(a.v, b.v); }
+    static f32x4 Sqrt(f32x4 a) { return _mm_sqrt_ps(a.v); }
+    // about 12 bits of 1 / sqrt(a)
+    static f32x4 RSqrt(f32x4 a) { return _mm_rsqrt_ps(a.v); }
+
+    // a * b + c, fused when the target has FMA
+    static f32x4 MulAdd(f32x4 a, f32x4 b, f32x4 c) {
+#if defined(__FMA__)
+        return _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+        return _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v);
+#endif
+    }
+
+    // rows to columns
+    static void Transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    }
+
+    // picks a where the mask is set and b everywhere else
+    static f32x4 Select(f32x4 mask, f32x4 a, f32x4 b) {
+        return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+    }
+
+    // one bit per lane, lane 0 in the lowest bit
+    i32 Mask() const { return _mm_movemask_ps(v); }
+#elif SIMD_NEON
+    f32x4(float32x4_t vv) : v(vv) {}
+    f32x4(r32 s) : v(vdupq_n_f32(s)) {}
+    f32x4(r32 a, r32 b, r32 c, r32 d) {
+        r32 values[4] = { a, b, c, d };
+        v = vld1q_f32(values);
+    }
+
+    static f32x4 Load(const r32* p) { return vld1q_f32(p); }
+    void Store(r32* p) const { vst1q_f32(p, v); }
+    static f32x4 LoadAligned(const r32* p) { return vld1q_f32(p); }
+    void StoreAligned(r32* p) const { vst1q_f32(p, v); }
+
+    static f32x4 LoadUnorm8(const u8* p) {
+        u32 bits;
+        memcpy(&bits, p, sizeof(bits));
+        uint16x8_t words = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(bits)));
+        return vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(words))), 1.0f / 255.0f);
+    }
+
+    f32x4 operator+(f32x4 b) const { return vaddq_f32(v, b.v); }
+    f32x4 operator-(f32x4 b) const { return vsubq_f32(v, b.v); }
+    f32x4 operator*(f32x4 b) const { return vmulq_f32(v, b.v); }
+    f32x4 operator/(f32x4 b) const { return vdivq_f32(v, b.v); }
+
+    f32x4 operator<(f32x4 b) const { return vreinterpretq_f32_u32(vcltq_f32(v, b.v)); }
+    f32x4 operator<=(f32x4 b) const { return vreinterpretq_f32_u32(vcleq_f32(v, b.v)); }
+    f32x4 operator>(f32x4 b) const { return vreinterpretq_f32_u32(vcgtq_f32(v, b.v)); }
+    f32x4 operator>=(f32x4 b) const { return vreinterpretq_f32_u32(vcgeq_f32(v, b.v)); }
+
+    f32x4 operator&(f32x4 b) const { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), vreinterpretq_u32_f32(b.v))); }
+    f32x4 operator|(f32x4 b) const { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(v), vreinterpretq_u32_f32(b.v))); }
+
+    static f32x4 Min(f32x4 a, f32x4 b) { return vminq_f32(a.v, b.v); }
+    static f32x4 Max(f32x4 a, f32x4 b) { return vmaxq_f32(a.v, b.v); }
+    static f32x4 Sqrt(f32x4 a) { return vsqrtq_f32(a.v); }
+    static f32x4 RSqrt(f32x4 a) { return vrsqrteq_f32(a.v); }
+
+    static f32x4 MulAdd(f32x4 a, f32x4 b, f32x4 c) {
+#if defined(__ARM_FEATURE_FMA)
+        return vfmaq_f32(c.v, a.v, b.v);
+#else
+        return vmlaq_f32(c.v, a.v, b.v);
+#endif
+    }
+
+    static void Transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+        float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+        float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+        a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+        b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+        c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+        d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+    }
+
+    static f32x4 Select(f32x4 mask, f32x4 a, f32x4 b) {
+        return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v);
+    }
+
+    i32 Mask() const {
+        const uint32x4_t weights = { 1, 2, 4, 8 };
+        uint32x4_t bits = vshrq_n_u32(vreinterpretq_u32_f32(v), 31);
+        return (i32)vaddvq_u32(vmulq_u32(bits, weights));
+    }
+#else
+    f32x4(r32 s) : v{ s, s, s, s } {}
+    f32x4(r32 a, r32 b, r32 c, r32 d) : v{ a, b, c, d } {}
+
+    static f32x4 Load(const r32* p) { return f32x4(p[0], p[1], p[2], p[3]); }
+    static f32x4 LoadAligned(const r32* p) { return Load(p); }
+    void StoreAligned(r32* p) const { Store(p); }
+    static f32x4 LoadUnorm8(const u8* p) {
+        return f32x4(p[0] * (1.0f / 255.0f), p[1] * (1.0f / 255.0f), p[2] * (1.0f / 255.0f), p[3] * (1.0f / 255.0f));
+    }
+    void Store(r32* p) const {
+        for (int i = 0; i < 4; ++i) {
+            p[i] = v[i];
+        }
+    }
+
+    template<typename F>
+    static f32x4 Map(f32x4 a, f32x4 b, F f) {
+        f32x4 result;
+        for (int i = 0; i < 4; ++i) {
+            result.v[i] = f(a.v[i], b.v[i]);
+        }
+        return result;
+    }
+
+    static r32 MaskLane(bool set) {
+        u32 bits = set ? 0xffffffff : 0;
+        r32 result;
+        memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    static u32 Bits(r32 f) {
+        u32 bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+
+    f32x4 operator+(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return x + y; }); }
+    f32x4 operator-(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return x - y; }); }
+    f32x4 operator*(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return x * y; }); }
+    f32x4 operator/(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return x / y; }); }
+
+    f32x4 operator<(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(x < y); }); }
+    f32x4 operator<=(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(x <= y); }); }
+    f32x4 operator>(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(x > y); }); }
+    f32x4 operator>=(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(x >= y); }); }
+
+    f32x4 operator&(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(Bits(x) & Bits(y)); }); }
+    f32x4 operator|(f32x4 b) const { return Map(*this, b, [](r32 x, r32 y) { return MaskLane(Bits(x) | Bits(y)); }); }
+
+    static f32x4 Min(f32x4 a, f32x4 b) { return Map(a, b, [](r32 x, r32 y) { return x < y ? x : y; }); }
+    static f32x4 Max(f32x4 a, f32x4 b) { return Map(a, b, [](r32 x, r32 y) { return x > y ? x : y; }); }
+    static f32x4 Sqrt(f32x4 a) { return Map(a, a, [](r32 x, r32 y) { return std::sqrt(x); }); }
+    static f32x4 RSqrt(f32x4 a) { return Map(a, a, [](r32 x, r32 y) { return 1.0f / std::sqrt(x); }); }
+    static f32x4 MulAdd(f32x4 a, f32x4 b, f32x4 c) { return a * b + c; }
+
+    static void Transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+        f32x4 rows[4] = { a, b, c, d };
+        a = f32x4(rows[0].v[0], rows[1].v[0], rows[2].v[0], rows[3].v[0]);
+        b = f32x4(rows[0].v[1], rows[1].v[1], rows[2].v[1], rows[3].v[1]);
+        c = f32x4(rows[0].v[2], rows[1].v[2], rows[2].v[2], rows[3].v[2]);
+        d = f32x4(rows[0].v[3], rows[1].v[3], rows[2].v[3], rows[3].v[3]);
+    }
+
+    static f32x4 Select(f32x4 mask, f32x4 a, f32x4 b) {
+        f32x4 result;
+        for (int i = 0; i < 4; ++i) {
+            result.v[i] = Bits(mask.v[i]) ? a.v[i] : b.v[i];
+        }
+        return result;
+    }
+
+    i32 Mask() const {
+        i32 result = 0;
+        for (int i = 0; i < 4; ++i) {
+            result |= (Bits(v[i]) >> 31) << i;
+        }
+        return result;
+    }
+#endif
+};
+
+// timestamp counter, only differences on the same thread mean anything
+inline u64 ReadCycleCounter() {
+#if SIMD_SSE2
+    return __rdtsc();
+#elif SIMD_NEON && defined(__aarch64__)
+    u64 ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// number of lanes set in a Mask() result
+inline i32 LaneCount(i32 mask) {
+    return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+}
+
+struct v3x4 {
+    f32x4 x;
+    f32x4 y;
+    f32x4 z;
+
+    v3x4() = default;
+    v3x4(f32x4 xx, f32x4 yy, f32x4 zz) : x(xx), y(yy), z(zz) {}
+
+    static f32x4 Dot(const v3x4& a, const v3x4& b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    v3x4 Normalized() const {
+        f32x4 length = f32x4::Sqrt(Dot(*this, *this));
+        return v3x4(x / length, y / length, z / length);
+    }
+
+    v3x4 operator-() const { return v3x4(f32x4(0.0f) - x, f32x4(0.0f) - y, f32x4(0.0f) - z); }
+    v3x4 operator-(const v3x4& b) const { return v3x4(x - b.x, y - b.y, z - b.z); }
+    v3x4 operator+(const v3x4& b) const { return v3x4(x + b.x, y + b.y, z + b.z); }
+    v3x4 operator*(f32x4 b) const { return v3x4(x * b, y * b, z * b); }
+};
+
+struct v4x4 {
+    f32x4 x;
+    f32x4 y;
+    f32x4 z;
+    f32x4 w;
+
+    v4x4() = default;
+    v4x4(f32x4 xx, f32x4 yy, f32x4 zz, f32x4 ww) : x(xx), y(yy), z(zz), w(ww) {}
+
+    v4x4 operator+(const v4x4& b) const { return v4x4(x + b.x, y + b.y, z + b.z, w + b.w); }
+    v4x4 operator*(const v4x4& b) const { return v4x4(x * b.x, y * b.y, z * b.z, w * b.w); }
+    v4x4 operator*(f32x4 b) const { return v4x4(x * b, y * b, z * b, w * b); }
+};
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool neon = false;
+
+    static const CpuFeatures& Get() {
+        static CpuFeatures features = Detect();
+        return features;
+    }
+
+    static CpuFeatures Detect() {
+        CpuFeatures result;
+#if SIMD_SSE2
+        u32 leaf1[4] = {};
+        u32 leaf7[4] = {};
+#if defined(_MSC_VER)
+        __cpuid((int*)leaf1, 1);
+        __cpuidex((int*)leaf7, 7, 0);
+#else
+        __get_cpuid(1, &leaf1[0], &leaf1[1], &leaf1[2], &leaf1[3]);
+        __get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+#endif
+        result.sse2 = (leaf1[3] >> 26) & 1;
+        result.sse41 = (leaf1[2] >> 19) & 1;
+        // the wide registers also need the OS to save them on context switches
+        bool osAvx = false;
+        if ((leaf1[2] >> 27) & 1) {
+#if defined(_MSC_VER)
+            osAvx = (_xgetbv(0) & 6) == 6;
+#else
+            u32 eax;
+            u32 edx;
+            __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            osAvx = (eax & 6) == 6;
+#endif
+        }
+        result.fma = osAvx && ((leaf1[2] >> 12) & 1);
+        result.avx2 = osAvx && ((leaf7[1] >> 5) & 1);
+#elif SIMD_NEON
+        result.neon = true;
+#endif
+        return result;
+    }
+
+    // whether f32x4 maps to real vector instructions on this machine
+    bool Wide() const {
+        return sse2 || neon;
+    }
+};
+
+#define CACHE_LINE_SIZE 64
+
+// keeps std::vector storage on Alignment byte boundaries
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) {
+        return (T*)::operator new(count * sizeof(T), std::align_val_t(Alignment));
+    }
+
+    void deallocate(T* pointer, size_t) {
+        ::operator delete(pointer, std::align_val_t(Alignment));
+    }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "global.hpp"
+
+// Scoped timeline markers exported as Chrome trace events (chrome://tracing, ui.perfetto.dev).
+// Build with -DENABLE_TRACING to record them, otherwise TRACE_SCOPE expands to nothing.
+
+#ifdef ENABLE_TRACING
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#define TRACE_BUFFER_SIZE (1 << 16)
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// name has to outlive the export, string literals are the intended use
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+struct TraceEvent {
+    const char* name;
+    u64 start;
+    u64 end;
+};
+
+// Written only by the thread that owns it, once full the oldest events get overwritten.
+// Readers pick up everything below head, so an export should not race with a frame in flight.
+struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_SIZE];
+    std::atomic<u32> head{0};
+    u32 threadId = 0;
+    const char* threadName = nullptr;
+
+    void Push(const char* name, u64 start, u64 end) {
+        u32 index = head.load(std::memory_order_relaxed);
+        events[index % TRACE_BUFFER_SIZE] = { name, start, end };
+        head.store(index + 1, std::memory_order_release);
+    }
+};
+
+struct Trace {
+    // the lock is only taken when a thread records its first event and on export
+    std::mutex mutex;
+    std::vector<TraceBuffer*> buffers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    static Trace& Get() {
+        static Trace trace;
+        return trace;
+    }
+
+    // buffers are never freed so events of threads that already exited can still be exported
+    static TraceBuffer& ThreadBuffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            Trace& trace = Get();
+            buffer = new TraceBuffer();
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            buffer->threadId = (u32)trace.buffers.size();
+            trace.buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    static u64 Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Get().epoch).count();
+    }
+
+    static void SetThreadName(const char* name) {
+        ThreadBuffer().threadName = name;
+    }
+
+    static void Clear() {
+        Trace& trace = Get();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        for (TraceBuffer* buffer : trace.buffers) {
+            buffer->head.store(0, std::memory_order_release);
+        }
+    }
+
+    static bool WriteChromeJSON(const char* path) {
+        FILE* file = fopen(path, "w");
+        if (!file) {
+            return false;
+        }
+
+        Trace& trace = Get();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+
+        fprintf(file, "{\"traceEvents\": [\n");
+        bool first = true;
+        for (TraceBuffer* buffer : trace.buffers) {
+            if (buffer->threadName) {
+                fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", buffer->threadId, buffer->threadName);
+                first = false;
+            }
+
+            u32 head = buffer->head.load(std::memory_order_acquire);
+            u32 begin = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+            for (u32 i = begin; i < head; ++i) {
+                const TraceEvent& event = buffer->events[i % TRACE_BUFFER_SIZE];
+                fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",\n", event.name, buffer->threadId, event.start / 1000.0, (event.end - event.start) / 1000.0);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        return true;
+    }
+};
+
+struct TraceScope {
+    const char* name;
+    u64 start;
+
+    TraceScope(const char* scopeName) : name(scopeName), start(Trace::Now()) {}
+
+    ~TraceScope() {
+        Trace::ThreadBuffer().Push(name, start, Trace::Now());
+    }
+};
+
+#else
+
+#define TRACE_SCOPE(name)
+
+struct Trace {
+    static void SetThreadName(const char* name) {}
+    static void Clear() {}
+    static bool WriteChromeJSON(const char* path) { return false; }
+};
+
+#endif
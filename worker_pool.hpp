@@ -0,0 +1,98 @@
+#pragma once
+
+#include "global.hpp"
+#include "trace.hpp"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// Persistent threads that pull job indices from a shared counter, the calling
+// thread takes part in the work as worker 0.
+struct WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    std::function<void(u32, u32)> job;
+    u32 jobCount = 0;
+    std::atomic<u32> nextJob{0};
+    u32 busyWorkers = 0;
+    u32 generation = 0;
+    bool quit = false;
+
+    WorkerPool(u32 threadCount) {
+        for (u32 i = 1; i < threadCount; ++i) {
+            threads.push_back(std::thread(&WorkerPool::WorkerLoop, this, i));
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    u32 ThreadCount() const {
+        return (u32)threads.size() + 1;
+    }
+
+    // runs function(jobIndex, workerIndex) for every job and returns once all of them are done
+    void Dispatch(u32 count, const std::function<void(u32, u32)>& function) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = function;
+            jobCount = count;
+            nextJob = 0;
+            busyWorkers = (u32)threads.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        Work(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return busyWorkers == 0; });
+    }
+
+    void Work(u32 worker) {
+        for (;;) {
+            u32 index = nextJob.fetch_add(1);
+            if (index >= jobCount) {
+                break;
+            }
+            job(index, worker);
+        }
+    }
+
+    void WorkerLoop(u32 worker) {
+        Trace::SetThreadName("Worker");
+        u32 seenGeneration = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seenGeneration; });
+                if (quit) {
+                    return;
+                }
+                seenGeneration = generation;
+            }
+
+            Work(worker);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+};